@@ -9,6 +9,9 @@ find_package(LLVM 6.0 REQUIRED CONFIG)
 message(STATUS "LLVM: ${LLVM_DIR}")
 llvm_map_components_to_libnames(llvm_libs support core passes mcjit native DebugInfoDWARF)
 
+# Also identifies the compiled object code in the object cache of Hera.
+set(wavm_revision 2c77c8a2e49bd291833d79fe6c68801b44ae634c)
+
 set(prefix ${CMAKE_BINARY_DIR}/deps)
 set(source_dir ${prefix}/src/wavm)
 set(binary_dir ${prefix}/src/wavm-build)
@@ -29,7 +32,7 @@ ExternalProject_Add(wavm
     DOWNLOAD_DIR ${prefix}/downloads
     SOURCE_DIR ${source_dir}
     BINARY_DIR ${binary_dir}
-    URL https://github.com/AndrewScheidecker/WAVM/archive/2c77c8a2e49bd291833d79fe6c68801b44ae634c.tar.gz
+    URL https://github.com/AndrewScheidecker/WAVM/archive/${wavm_revision}.tar.gz
     URL_HASH SHA256=044b09afb6b62e0b1ad16dde3ef773f72dd077d7c54c88d6716162caa9eca2e7
     PATCH_COMMAND sh ${CMAKE_CURRENT_LIST_DIR}/patch_wavm.sh
     CMAKE_ARGS
@@ -53,7 +56,8 @@ set_target_properties(
     PROPERTIES
     IMPORTED_CONFIGURATIONS Release
     IMPORTED_LOCATION_RELEASE ${runtime_library}
-    INTERFACE_INCLUDE_DIRECTORIES ${include_dir}
+    INTERFACE_INCLUDE_DIRECTORIES "${include_dir};${LLVM_INCLUDE_DIRS}"
+    INTERFACE_COMPILE_DEFINITIONS HERA_WAVM_REVISION=${wavm_revision}
     INTERFACE_LINK_LIBRARIES "${other_libraries};${llvm_libs}"
 )
 
@@ -2,3 +2,23 @@
 
 sed -iE 's/SHARED//' CMakeLists.txt
 sed -iE 's/-Werror//' CMakeLists.txt
+
+# Let the JIT use the object cache supplied by Hera (see src/wavm-object-cache.h).
+# The pointer is weak, so the programs of WAVM itself still link without Hera.
+jit=Lib/Runtime/LLVMJIT.cpp
+sed -i 's/llvm::orc::SimpleCompiler(\*targetMachine)/llvm::orc::SimpleCompiler(*targetMachine, \&wavmObjectCache ? wavmObjectCache : nullptr)/' $jit
+if grep -q wavmObjectCache $jit; then
+  sed -i '1i namespace llvm { class ObjectCache; }\nextern llvm::ObjectCache* wavmObjectCache __attribute__((weak));' $jit
+else
+  echo "warning: the object cache hook could not be added to WAVM, wavm-cache-dir will have no effect" >&2
+fi
+
+# Let Hera release its runtime lock while the JIT compiles a module being instantiated
+# (see InstantiationScope in src/wavm.cpp). Without the hook, the lock is held throughout.
+instance=Lib/Runtime/ModuleInstance.cpp
+sed -i 's/^\([[:space:]]*\)\(LLVMJIT::instantiateModule([^;]*);\)/\1if(\&wavmCompileBegin) wavmCompileBegin();\n\1\2\n\1if(\&wavmCompileEnd) wavmCompileEnd();/' $instance
+if grep -q wavmCompileBegin $instance; then
+  sed -i '1i extern void wavmCompileBegin() __attribute__((weak));\nextern void wavmCompileEnd() __attribute__((weak));' $instance
+else
+  echo "warning: the compile hook could not be added to WAVM, compilations will block executions" >&2
+fi
@@ -0,0 +1,65 @@
+#!/usr/bin/env node
+
+// Stand-in for evm2wasm-worker.js, used by translator-tests.sh to test how Hera
+// handles a misbehaving translator. It speaks the same protocol, and the first
+// byte of the bytecode selects the behaviour:
+//   0xfc: never answer (timeout)
+//   0xfd: answer with a failure
+//   0xfe: exit without answering (crash)
+//   0xff: answer, then exit
+// Anything else is answered with an empty module, carrying the process id in
+// a custom section named "pid".
+
+let pending = Buffer.alloc(0)
+
+function respond (status, payload) {
+  const header = Buffer.alloc(5)
+  header.writeUInt8(status, 0)
+  header.writeUInt32LE(payload.length, 1)
+  process.stdout.write(Buffer.concat([header, payload]))
+}
+
+function module () {
+  const pid = Buffer.from(String(process.pid))
+  const name = Buffer.from('pid')
+  return Buffer.concat([
+    Buffer.from([0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00]),
+    Buffer.from([0x00, 1 + name.length + pid.length, name.length]),
+    name,
+    pid
+  ])
+}
+
+function handle (code) {
+  switch (code[0]) {
+    case 0xfc:
+      break
+    case 0xfd:
+      respond(1, Buffer.from('stub failure'))
+      break
+    case 0xfe:
+      process.exit(1)
+      break
+    case 0xff:
+      respond(0, module())
+      process.stdout.write('', () => process.exit(0))
+      break
+    default:
+      respond(0, module())
+  }
+}
+
+process.stdin.on('data', chunk => {
+  pending = Buffer.concat([pending, chunk])
+  while (pending.length >= 5) {
+    const length = pending.readUInt32LE(1)
+    if (pending.length < 5 + length) {
+      break
+    }
+    const code = pending.slice(5, 5 + length)
+    pending = pending.slice(5 + length)
+    handle(code)
+  }
+})
+
+process.stdin.on('end', () => process.exit(0))
@@ -0,0 +1,43 @@
+#!/usr/bin/env node
+
+// Long-lived evm2wasm translator used by Hera's `evm2wasm.js-worker` evm1mode.
+//
+// Reads requests from stdin and writes responses to stdout, integers are little-endian:
+//   request:  u8 flags (bit 0: tracing), u32 length, EVM1 bytecode
+//   response: u8 status (0: success), u32 length, WebAssembly binary (or error message)
+
+const evm2wasm = require('evm2wasm')
+
+let pending = Buffer.alloc(0)
+let queue = Promise.resolve()
+
+function respond (status, payload) {
+  const header = Buffer.alloc(5)
+  header.writeUInt8(status, 0)
+  header.writeUInt32LE(payload.length, 1)
+  process.stdout.write(Buffer.concat([header, payload]))
+}
+
+function translate (code, trace) {
+  return Promise.resolve()
+    .then(() => evm2wasm.evm2wasm(code, { stackTrace: trace, chargePerOp: true }))
+    .then(wasm => respond(0, Buffer.from(wasm)))
+    .catch(err => respond(1, Buffer.from(String(err))))
+}
+
+process.stdin.on('data', chunk => {
+  pending = Buffer.concat([pending, chunk])
+  while (pending.length >= 5) {
+    const length = pending.readUInt32LE(1)
+    if (pending.length < 5 + length) {
+      break
+    }
+    const trace = (pending.readUInt8(0) & 1) !== 0
+    const code = pending.slice(5, 5 + length)
+    pending = pending.slice(5 + length)
+    // Answer strictly in order.
+    queue = queue.then(() => translate(code, trace))
+  }
+})
+
+process.stdin.on('end', () => process.exit(0))
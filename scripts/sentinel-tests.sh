@@ -0,0 +1,67 @@
+#!/usr/bin/env bash
+
+# Compares the metering injected by Hera with the Sentinel contract on a corpus:
+# the ewasm state tests, run with sentinel=verify. Every difference is reported
+# in the debug output of Hera (built with -DHERA_DEBUGGING=ON, the default) and
+# fails this script.
+#
+# Usage: SENTINEL=<sentinel.wasm> sentinel-tests.sh [build]
+
+set -e
+
+if [ -z "$SENTINEL" ]
+then
+  echo "SENTINEL must be set to the Sentinel contract (a .wasm file)"
+  exit 2
+fi
+
+if [ "$1" == "build" ]
+then
+(
+  git clone --recursive https://github.com/ethereum/cpp-ethereum
+  cd cpp-ethereum
+
+  rm -rf hera
+  ln -s `pwd`/../. hera
+
+  mkdir build
+  cd build
+  cmake -DHERA=ON ..
+  make
+)
+  TESTETH=$(pwd)/cpp-ethereum/build/test/testeth
+else
+  TESTETH=testeth
+fi
+
+WORKING_DIR=$(pwd)
+echo "running sentinel-tests.sh inside working dir: $WORKING_DIR"
+
+echo "fetch ewasm tests."
+if [ ! -d tests ]
+then
+  git clone https://github.com/ewasm/tests -b wasm-tests --single-branch
+fi
+
+echo "run ewasm tests with the Sentinel verified."
+LOG=$(mktemp)
+STATUS=0
+${TESTETH} -t GeneralStateTests/stEWASMTests -- --testpath ./tests --vm hera --singlenet "Byzantium" \
+  --evmc metering=true --evmc sentinel=verify --evmc sys:sentinel="$SENTINEL" 2> "$LOG" || STATUS=$?
+cat "$LOG" >&2
+
+DIFFERENCES=$(grep -c "^Native metering " "$LOG" || true)
+DEBUGGING=$(grep -c "^Executing message in Hera" "$LOG" || true)
+rm -f "$LOG"
+if [ "$DEBUGGING" == "0" ]
+then
+  echo "no debug output found, Hera must be built with -DHERA_DEBUGGING=ON"
+  exit 2
+fi
+if [ "$DIFFERENCES" != "0" ]
+then
+  echo "native metering differs from the Sentinel in $DIFFERENCES deployments"
+  exit 1
+fi
+echo "native metering matches the Sentinel"
+exit $STATUS
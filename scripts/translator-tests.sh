@@ -0,0 +1,83 @@
+#!/usr/bin/env bash
+
+# Tests TranslatorProcess (the evm2wasm.js-worker evm1mode) against the stub
+# translator in evm2wasm-worker-stub.js: timeouts, crashes and restarts, and
+# failure replies. Needs a C++ compiler and node.
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+WORKING_DIR=$(mktemp -d)
+trap 'rm -rf "$WORKING_DIR"' EXIT
+
+cat > "$WORKING_DIR/driver.cpp" <<'CPP'
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "translator.h"
+
+using namespace std;
+using namespace hera;
+
+namespace {
+
+const vector<uint8_t> plain{0x60};
+const vector<uint8_t> hang{0xfc};
+const vector<uint8_t> failure{0xfd};
+const vector<uint8_t> crash{0xfe};
+const vector<uint8_t> lastAnswer{0xff};
+
+void check(bool condition, char const* what)
+{
+  cout << (condition ? "ok: " : "FAILED: ") << what << "\n";
+  if (!condition)
+    exit(1);
+}
+
+// The process id in the module returned by the stub.
+string pidOf(vector<uint8_t> const& output)
+{
+  // Header, section id and size, name length, "pid".
+  return (output.size() > 14) ? string(output.begin() + 14, output.end()) : string();
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 2)
+    return 2;
+  TranslatorProcess translator(string("node ") + argv[1], chrono::milliseconds(1000));
+
+  string pid = pidOf(translator.translate(plain, false));
+  check(!pid.empty(), "translates");
+
+  check(translator.translate(failure, false).empty(), "failure reply gives no output");
+  check(pidOf(translator.translate(plain, false)) == pid, "failure reply keeps the process");
+
+  check(translator.translate(crash, false).empty(), "crash gives no output");
+  string restarted = pidOf(translator.translate(plain, false));
+  check(!restarted.empty() && restarted != pid, "restarts after a crash");
+
+  pid = pidOf(translator.translate(lastAnswer, false));
+  check(!pid.empty(), "translates before exiting");
+  restarted = pidOf(translator.translate(plain, false));
+  check(!restarted.empty() && restarted != pid, "restarts after an exit between requests");
+
+  auto start = chrono::steady_clock::now();
+  check(translator.translate(hang, false).empty(), "timeout gives no output");
+  auto elapsed = chrono::steady_clock::now() - start;
+  check(elapsed >= chrono::milliseconds(1000) && elapsed < chrono::milliseconds(5000), "times out after the timeout");
+  pid = restarted;
+  restarted = pidOf(translator.translate(plain, false));
+  check(!restarted.empty() && restarted != pid, "restarts after a timeout");
+
+  return 0;
+}
+CPP
+
+${CXX:-c++} -std=c++11 -pthread -I"$ROOT/src" "$WORKING_DIR/driver.cpp" "$ROOT/src/translator.cpp" -o "$WORKING_DIR/driver"
+"$WORKING_DIR/driver" "$ROOT/scripts/evm2wasm-worker-stub.js"
@@ -14,6 +14,10 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 #include <pass.h>
@@ -28,6 +32,8 @@
 #include "debugging.h"
 #include "eei.h"
 #include "exceptions.h"
+#include "memory-region.h"
+#include "metering.h"
 
 #include "shell-interface.h"
 
@@ -35,529 +41,646 @@ using namespace std;
 
 namespace hera {
 
-class BinaryenEthereumInterface : public wasm::ShellExternalInterface, EthereumInterface {
-public:
-  explicit BinaryenEthereumInterface(
-    evmc_context* _context,
-    vector<uint8_t> const& _code,
-    evmc_message const& _msg,
-    ExecutionResult & _result,
-    bool _meterGas
-  ):
-    ShellExternalInterface(),
-    EthereumInterface(_context, _code, _msg, _result, _meterGas)
-  { }
-
-protected:
-  wasm::Literal callImport(wasm::Import *import, wasm::LiteralList& arguments) override;
-#if HERA_DEBUGGING
-  wasm::Literal callDebugImport(wasm::Import *import, wasm::LiteralList& arguments);
-#endif
-
-  void importGlobals(map<wasm::Name, wasm::Literal>& globals, wasm::Module& wasm) override;
-
-  void trap(const char* why) override {
-    ensureCondition(false, VMTrap, why);
-  }
-
-private:
-  size_t memorySize() const override { return memory.size(); }
-  void memorySet(size_t offset, uint8_t value) override { memory.set<uint8_t>(offset, value); }
-  uint8_t memoryGet(size_t offset) override { return memory.get<uint8_t>(offset); }
-};
-
-  void BinaryenEthereumInterface::importGlobals(map<wasm::Name, wasm::Literal>& globals, wasm::Module& wasm) {
-    (void)globals;
-    (void)wasm;
-    HERA_DEBUG << "importGlobals\n";
-  }
-
-#if HERA_DEBUGGING
-  wasm::Literal BinaryenEthereumInterface::callDebugImport(wasm::Import *import, wasm::LiteralList& arguments) {
-    heraAssert(import->module == wasm::Name("debug"), "Import namespace error.");
-
-    if (import->base == wasm::Name("print32")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t value = static_cast<uint32_t>(arguments[0].geti32());
+namespace {
+// Binaryen interns every name in a global table which is not thread-safe. Names
+// are only created while parsing (which is serialized) and here, at load time.
+const wasm::Name mainExportName("main");
 
-      cerr << "DEBUG print32: " << value << " " << hex << "0x" << value << dec << endl;
+mutex parserMutex;
+}
 
-      return wasm::Literal();
-    }
+class BinaryenEthereumInterface;
 
-    if (import->base == wasm::Name("print64")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
+// Host function bound to an import, resolved once per module. The argument
+// count and types are guaranteed by the signature checks in verifyContract().
+using ImportFunction = wasm::Literal (*)(BinaryenEthereumInterface&, wasm::LiteralList&);
 
-      uint64_t value = static_cast<uint64_t>(arguments[0].geti64());
+// An import carrying its index in the dispatch table of the module. The
+// interpreter hands the import back on every host call, so the host function
+// is found without a lookup.
+struct IndexedImport : wasm::Import {
+  IndexedImport(wasm::Import const& import, size_t _index):
+    wasm::Import(import),
+    index(_index)
+  { }
 
-      cerr << "DEBUG print64: " << value << " " << hex << "0x" << value << dec << endl;
+  size_t index;
+};
 
-      return wasm::Literal();
-    }
+// The memory and the table of an instance after its segments were applied.
+struct BinaryenSnapshot {
+  BinaryenSnapshot(char const* memoryData, size_t memorySize, vector<wasm::Name> _table):
+    memory(memoryData, memorySize),
+    table(move(_table))
+  { }
 
-    if (import->base == wasm::Name("printMem") || import->base == wasm::Name("printMemHex")) {
-      heraAssert(arguments.size() == 2, string("Argument count mismatch in: ") + import->base.str);
+  MemoryImage memory;
+  vector<wasm::Name> table;
+};
 
-      uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t length = static_cast<uint32_t>(arguments[1].geti32());
+// A parsed and validated module together with its resolved imports.
+struct BinaryenModule : PreparedModule {
+  ~BinaryenModule() noexcept override
+  {
+    // Import has no virtual destructor, the imports are deleted as what they are.
+    if (importsIndexed)
+      for (auto& import: module.imports)
+        delete static_cast<IndexedImport*>(import.release());
+  }
 
-      debugPrintMem(import->base == wasm::Name("printMemHex"), offset, length);
+  wasm::Module module;
+  // Indexed by IndexedImport::index, nullptr for unsupported imports.
+  vector<ImportFunction> imports;
+  // Whether every import of the module is an IndexedImport.
+  bool importsIndexed = false;
+  size_t codeSize = 0;
+  // An upper bound of the size of the snapshot, which is only taken later.
+  size_t snapshotSize = 0;
+  // Whether gas is charged from a global, see MeteringCharge::Counter.
+  bool nativeMetering = false;
+  // The global holding the gas left during an execution under native metering.
+  wasm::Name gasCounter;
+  // Taken by the first instance, accessed with atomic_load() and atomic_store().
+  mutable shared_ptr<BinaryenSnapshot const> snapshot;
+
+  // The in-memory representation is considerably larger than the binary. This is
+  // only a rough estimate to keep the budget meaningful.
+  size_t memoryCost() const override { return codeSize * 8 + snapshotSize; }
+};
 
-      return wasm::Literal();
-    }
+// The external interface of an instance. It owns the linear memory and
+// forwards host calls to the interface of the execution in progress.
+class BinaryenHostInterface : public wasm::ShellExternalInterface {
+public:
+  explicit BinaryenHostInterface(BinaryenModule const& _module):
+    ShellExternalInterface(),
+    m_module(_module)
+  { }
 
-    if (import->base == wasm::Name("printStorage") || import->base == wasm::Name("printStorageHex")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
+  void bind(BinaryenEthereumInterface* _interface, ExecutionResult* _result) {
+    m_interface = _interface;
+    m_result = _result;
+  }
 
-      uint32_t pathOffset = static_cast<uint32_t>(arguments[0].geti32());
+  /// Under native metering the gas left is kept in a global during the
+  /// execution, and in the result while the host is called.
+  void loadGasCounter() { m_instance->globals[m_module.gasCounter] = wasm::Literal(m_result->gasLeft); }
+  void storeGasCounter() { m_result->gasLeft = m_instance->globals[m_module.gasCounter].geti64(); }
 
-      debugPrintStorage(import->base == wasm::Name("printStorageHex"), pathOffset);
+protected:
+  void init(wasm::Module& wasm, wasm::ModuleInstance& instance) override;
 
-      return wasm::Literal();
-    }
+  wasm::Literal callImport(wasm::Import *import, wasm::LiteralList& arguments) override;
 
-    if (import->base == wasm::Name("evmTrace")) {
-      heraAssert(arguments.size() == 4, string("Argument count mismatch in: ") + import->base.str);
+  void importGlobals(map<wasm::Name, wasm::Literal>& globals, wasm::Module& wasm) override;
 
-      uint32_t pc = static_cast<uint32_t>(arguments[0].geti32());
-      int32_t opcode = arguments[1].geti32();
-      uint32_t cost = static_cast<uint32_t>(arguments[2].geti32());
-      int32_t sp = arguments[3].geti32();
+  void trap(const char* why) override {
+    ensureCondition(false, VMTrap, why);
+  }
 
-      debugEvmTrace(pc, opcode, cost, sp);
+private:
+  BinaryenModule const& m_module;
+  wasm::ModuleInstance* m_instance = nullptr;
+  BinaryenEthereumInterface* m_interface = nullptr;
+  ExecutionResult* m_result = nullptr;
+};
 
-      return wasm::Literal();
-    }
+class BinaryenEthereumInterface : public EthereumInterface {
+public:
+  explicit BinaryenEthereumInterface(
+    evmc_context* _context,
+    vector<uint8_t> const& _code,
+    evmc_message const& _msg,
+    ExecutionResult & _result,
+    bool _meterGas,
+    BinaryenHostInterface & _host
+  ):
+    EthereumInterface(_context, _code, _msg, _result, _meterGas),
+    m_host(_host)
+  { }
 
-    heraAssert(false, string("Unsupported import called: ") + import->module.str + "::" + import->base.str + " (" + to_string(arguments.size()) + " arguments)");
-  }
-#endif
+  /// Finds the host function for an import.
+  /// @returns nullptr if the import is not supported.
+  static ImportFunction resolveImport(wasm::Import const& import);
 
-  wasm::Literal BinaryenEthereumInterface::callImport(wasm::Import *import, wasm::LiteralList& arguments) {
+protected:
 #if HERA_DEBUGGING
-    if (import->module == wasm::Name("debug"))
-      // Reroute to debug namespace
-      return callDebugImport(import, arguments);
+  static ImportFunction resolveDebugImport(wasm::Import const& import);
 #endif
-    
-    HERA_DEBUG << "importing::" <<  import->module << " . " << import->base << "\n";
-    heraAssert(import->module == wasm::Name("ethereum"), "Only imports from the 'ethereum' namespace are allowed.");
-
-    if (import->base == wasm::Name("useGas")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      int64_t gas = arguments[0].geti64();
-
-      eeiUseGas(gas);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getGasLeft")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
-
-      return wasm::Literal(eeiGetGasLeft());
-    }
-
-    if (import->base == wasm::Name("getAddress")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
-
-      eeiGetAddress(resultOffset);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getExternalBalance")) {
-      heraAssert(arguments.size() == 2, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
-
-      eeiGetExternalBalance(addressOffset, resultOffset);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getBlockHash")) {
-      heraAssert(arguments.size() == 2, string("Argument count mismatch in: ") + import->base.str);
-
-      uint64_t number = static_cast<uint64_t>(arguments[0].geti64());
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
-
-      return wasm::Literal(eeiGetBlockHash(number, resultOffset));
-    }
-
-    if (import->base == wasm::Name("getCallDataSize")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
-
-      return wasm::Literal(eeiGetCallDataSize());
-    }
-
-    if (import->base == wasm::Name("callDataCopy")) {
-      heraAssert(arguments.size() == 3, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t dataOffset = static_cast<uint32_t>(arguments[1].geti32());
-      uint32_t length = static_cast<uint32_t>(arguments[2].geti32());
-
-      eeiCallDataCopy(resultOffset, dataOffset, length);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getCaller")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
-
-      eeiGetCaller(resultOffset);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getCallValue")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
-
-      eeiGetCallValue(resultOffset);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("codeCopy")) {
-      heraAssert(arguments.size() == 3, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t codeOffset = static_cast<uint32_t>(arguments[1].geti32());
-      uint32_t length = static_cast<uint32_t>(arguments[2].geti32());
-
-      eeiCodeCopy(resultOffset, codeOffset, length);
 
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getCodeSize")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
-
-      return wasm::Literal(eeiGetCodeSize());
-    }
-
-    if (import->base == wasm::Name("externalCodeCopy")) {
-      heraAssert(arguments.size() == 4, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
-      uint32_t codeOffset = static_cast<uint32_t>(arguments[2].geti32());
-      uint32_t length = static_cast<uint32_t>(arguments[3].geti32());
-
-      eeiExternalCodeCopy(addressOffset, resultOffset, codeOffset, length);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getExternalCodeSize")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
-
-      return wasm::Literal(eeiGetExternalCodeSize(addressOffset));
-    }
-
-    if (import->base == wasm::Name("getBlockCoinbase")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
-
-      eeiGetBlockCoinbase(resultOffset);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getBlockDifficulty")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
-
-      eeiGetBlockDifficulty(offset);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getBlockGasLimit")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
-
-      return wasm::Literal(eeiGetBlockGasLimit());
-    }
-
-    if (import->base == wasm::Name("getTxGasPrice")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t valueOffset = static_cast<uint32_t>(arguments[0].geti32());
-
-      eeiGetTxGasPrice(valueOffset);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("log")) {
-      heraAssert(arguments.size() == 7, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t dataOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t length = static_cast<uint32_t>(arguments[1].geti32());
-      uint32_t numberOfTopics = static_cast<uint32_t>(arguments[2].geti32());
-      uint32_t topic1 = static_cast<uint32_t>(arguments[3].geti32());
-      uint32_t topic2 = static_cast<uint32_t>(arguments[4].geti32());
-      uint32_t topic3 = static_cast<uint32_t>(arguments[5].geti32());
-      uint32_t topic4 = static_cast<uint32_t>(arguments[6].geti32());
-
-      eeiLog(dataOffset, length, numberOfTopics, topic1, topic2, topic3, topic4);
-
-      return wasm::Literal();
-    }
-
-    if (import->base == wasm::Name("getBlockNumber")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
-
-      return wasm::Literal(eeiGetBlockNumber());
-    }
-
-    if (import->base == wasm::Name("getBlockTimestamp")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
-
-      return wasm::Literal(eeiGetBlockTimestamp());
-    }
-
-    if (import->base == wasm::Name("getTxOrigin")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+private:
+  size_t memorySize() const override { return m_host.memory.size(); }
+  uint8_t* memoryData() override { return reinterpret_cast<uint8_t*>(m_host.memory.data()); }
 
-      eeiGetTxOrigin(resultOffset);
+  BinaryenHostInterface & m_host;
+};
 
-      return wasm::Literal();
-    }
+class BinaryenInstance : public WasmInstance {
+public:
+  explicit BinaryenInstance(shared_ptr<BinaryenModule const> _module):
+    m_module(move(_module)),
+    m_host(*m_module),
+    // The interpreter only reads the module, it is not modified.
+    m_instance(const_cast<wasm::Module&>(m_module->module), &m_host)
+  { }
 
-    if (import->base == wasm::Name("storageStore")) {
-      heraAssert(arguments.size() == 2, string("Argument count mismatch in: ") + import->base.str);
+  ExecutionResult run(
+    evmc_context* context,
+    vector<uint8_t> const& state_code,
+    evmc_message const& msg,
+    bool meterInterfaceGas
+  ) override;
 
-      uint32_t pathOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t valueOffset = static_cast<uint32_t>(arguments[1].geti32());
+private:
+  shared_ptr<BinaryenModule const> m_module;
+  BinaryenHostInterface m_host;
+  wasm::ModuleInstance m_instance;
+};
 
-      eeiStorageStore(pathOffset, valueOffset);
+  void BinaryenHostInterface::init(wasm::Module& wasm, wasm::ModuleInstance& instance) {
+    m_instance = &instance;
 
-      return wasm::Literal();
+    // The segments are the same for every instance, only the first one applies them.
+    shared_ptr<BinaryenSnapshot const> snapshot = atomic_load(&m_module.snapshot);
+    if (snapshot) {
+      memory.assign(snapshot->memory);
+      table = snapshot->table;
+      return;
     }
 
-    if (import->base == wasm::Name("storageLoad")) {
-      heraAssert(arguments.size() == 2, string("Argument count mismatch in: ") + import->base.str);
-
-      uint32_t pathOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
-
-      eeiStorageLoad(pathOffset, resultOffset);
-
-      return wasm::Literal();
-    }
+    ShellExternalInterface::init(wasm, instance);
+    // Concurrent first instances may each take one, either is fine.
+    atomic_store(&m_module.snapshot, shared_ptr<BinaryenSnapshot const>{make_shared<BinaryenSnapshot>(memory.data(), memory.size(), table)});
+  }
 
-    if (import->base == wasm::Name("finish")) {
-      heraAssert(arguments.size() == 2, string("Argument count mismatch in: ") + import->base.str);
+  void BinaryenHostInterface::importGlobals(map<wasm::Name, wasm::Literal>& globals, wasm::Module& wasm) {
+    (void)globals;
+    (void)wasm;
+    HERA_DEBUG << "importGlobals\n";
+  }
 
-      uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t size = static_cast<uint32_t>(arguments[1].geti32());
+#if HERA_DEBUGGING
+  ImportFunction BinaryenEthereumInterface::resolveDebugImport(wasm::Import const& import) {
+    heraAssert(import.module == wasm::Name("debug"), "Import namespace error.");
 
-      // This traps.
-      eeiFinish(offset, size);
-    }
+    // The debug namespace is not validated, hence the argument count checks.
+    static const map<wasm::Name, ImportFunction> functions{
+      { wasm::Name("print32"), [](BinaryenEthereumInterface&, wasm::LiteralList& arguments) {
+        heraAssert(arguments.size() == 1, "Argument count mismatch in: print32");
 
-    if (import->base == wasm::Name("revert")) {
-      heraAssert(arguments.size() == 2, string("Argument count mismatch in: ") + import->base.str);
+        uint32_t value = static_cast<uint32_t>(arguments[0].geti32());
 
-      uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t size = static_cast<uint32_t>(arguments[1].geti32());
+        cerr << "DEBUG print32: " << value << " " << hex << "0x" << value << dec << endl;
 
-      // This traps.
-      eeiRevert(offset, size);
-    }
+        return wasm::Literal();
+      } },
+      { wasm::Name("print64"), [](BinaryenEthereumInterface&, wasm::LiteralList& arguments) {
+        heraAssert(arguments.size() == 1, "Argument count mismatch in: print64");
 
-    if (import->base == wasm::Name("getReturnDataSize")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
+        uint64_t value = static_cast<uint64_t>(arguments[0].geti64());
 
-      return wasm::Literal(eeiGetReturnDataSize());
-    }
+        cerr << "DEBUG print64: " << value << " " << hex << "0x" << value << dec << endl;
 
-    if (import->base == wasm::Name("returnDataCopy")) {
-      heraAssert(arguments.size() == 3, string("Argument count mismatch in: ") + import->base.str);
+        return wasm::Literal();
+      } },
+      { wasm::Name("printMem"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        heraAssert(arguments.size() == 2, "Argument count mismatch in: printMem");
 
-      uint32_t dataOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t offset = static_cast<uint32_t>(arguments[1].geti32());
-      uint32_t size = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t length = static_cast<uint32_t>(arguments[1].geti32());
 
-      eeiReturnDataCopy(dataOffset, offset, size);
+        interface.debugPrintMem(false, offset, length);
 
-      return wasm::Literal();
-    }
+        return wasm::Literal();
+      } },
+      { wasm::Name("printMemHex"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        heraAssert(arguments.size() == 2, "Argument count mismatch in: printMemHex");
 
-    if (
-      import->base == wasm::Name("call") ||
-      import->base == wasm::Name("callCode") ||
-      import->base == wasm::Name("callDelegate") ||
-      import->base == wasm::Name("callStatic")
-    ) {
-      EEICallKind kind;
-      if (import->base == wasm::Name("call"))
-        kind = EEICallKind::Call;
-      else if (import->base == wasm::Name("callCode"))
-        kind = EEICallKind::CallCode;
-      else if (import->base == wasm::Name("callDelegate"))
-        kind = EEICallKind::CallDelegate;
-      else if (import->base == wasm::Name("callStatic"))
-        kind = EEICallKind::CallStatic;
-      else
-        heraAssert(false, "");
-
-      if ((kind == EEICallKind::Call) || (kind == EEICallKind::CallCode)) {
-        heraAssert(arguments.size() == 5, string("Argument count mismatch in: ") + import->base.str);
-      } else {
-        heraAssert(arguments.size() == 4, string("Argument count mismatch in: ") + import->base.str);
-      }
-
-      int64_t gas = arguments[0].geti64();
-      uint32_t addressOffset = static_cast<uint32_t>(arguments[1].geti32());
-      uint32_t valueOffset;
-      uint32_t dataOffset;
-      uint32_t dataLength;
-
-      if (kind == EEICallKind::Call || kind == EEICallKind::CallCode) {
-        valueOffset = static_cast<uint32_t>(arguments[2].geti32());
-        dataOffset = static_cast<uint32_t>(arguments[3].geti32());
-        dataLength = static_cast<uint32_t>(arguments[4].geti32());
-      } else {
-        valueOffset = 0;
-        dataOffset = static_cast<uint32_t>(arguments[2].geti32());
-        dataLength = static_cast<uint32_t>(arguments[3].geti32());
-      }
-
-      return wasm::Literal(eeiCall(kind, gas, addressOffset, valueOffset, dataOffset, dataLength));
-    }
+        uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t length = static_cast<uint32_t>(arguments[1].geti32());
 
-    if (import->base == wasm::Name("create")) {
-      heraAssert(arguments.size() == 4, string("Argument count mismatch in: ") + import->base.str);
+        interface.debugPrintMem(true, offset, length);
 
-      uint32_t valueOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t dataOffset = static_cast<uint32_t>(arguments[1].geti32());
-      uint32_t length = static_cast<uint32_t>(arguments[2].geti32());
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[3].geti32());
+        return wasm::Literal();
+      } },
+      { wasm::Name("printStorage"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        heraAssert(arguments.size() == 1, "Argument count mismatch in: printStorage");
 
-      return wasm::Literal(eeiCreate(valueOffset, dataOffset, length, resultOffset));
-    }
+        uint32_t pathOffset = static_cast<uint32_t>(arguments[0].geti32());
 
+        interface.debugPrintStorage(false, pathOffset);
 
+        return wasm::Literal();
+      } },
+      { wasm::Name("printStorageHex"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        heraAssert(arguments.size() == 1, "Argument count mismatch in: printStorageHex");
 
-    if (import->base == wasm::Name("selfDestruct")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
+        uint32_t pathOffset = static_cast<uint32_t>(arguments[0].geti32());
 
-      uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
+        interface.debugPrintStorage(true, pathOffset);
 
-      // This traps.
-      eeiSelfDestruct(addressOffset);
-    }
+        return wasm::Literal();
+      } },
+      { wasm::Name("evmTrace"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        heraAssert(arguments.size() == 4, "Argument count mismatch in: evmTrace");
 
-    if (import->base == wasm::Name("getExternalCodeHash")) {
-      heraAssert(arguments.size() == 2, string("Argument count mismatch in: ") + import->base.str);
+        uint32_t pc = static_cast<uint32_t>(arguments[0].geti32());
+        int32_t opcode = arguments[1].geti32();
+        uint32_t cost = static_cast<uint32_t>(arguments[2].geti32());
+        int32_t sp = arguments[3].geti32();
 
-      uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t resultOffset  = static_cast<uint32_t>(arguments[1].geti32());
+        interface.debugEvmTrace(pc, opcode, cost, sp);
 
-      eeiGetExternalCodeHash(addressOffset, resultOffset);
-    }
+        return wasm::Literal();
+      } },
+    };
 
+    auto it = functions.find(import.base);
+    return (it != functions.end()) ? it->second : nullptr;
+  }
+#endif
 
-    if (import->base == wasm::Name("getChainID")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
-      return wasm::Literal(eeiGetChainID());
-    }
+  ImportFunction BinaryenEthereumInterface::resolveImport(wasm::Import const& import) {
+#if HERA_DEBUGGING
+    if (import.module == wasm::Name("debug"))
+      // Reroute to debug namespace
+      return resolveDebugImport(import);
+#endif
 
-    if (import->base == wasm::Name("getSelfBalance")) {
-      heraAssert(arguments.size() == 1, string("Argument count mismatch in: ") + import->base.str);
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
+    if (import.module != wasm::Name("ethereum"))
+      return nullptr;
+
+    static const map<wasm::Name, ImportFunction> functions{
+      { wasm::Name("useGas"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        int64_t gas = arguments[0].geti64();
+
+        interface.eeiUseGas(gas);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getGasLeft"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetGasLeft());
+      } },
+      { wasm::Name("getAddress"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        interface.eeiGetAddress(resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getExternalBalance"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
+
+        interface.eeiGetExternalBalance(addressOffset, resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getBlockHash"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint64_t number = static_cast<uint64_t>(arguments[0].geti64());
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
+
+        return wasm::Literal(interface.eeiGetBlockHash(number, resultOffset));
+      } },
+      { wasm::Name("getCallDataSize"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetCallDataSize());
+      } },
+      { wasm::Name("callDataCopy"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t length = static_cast<uint32_t>(arguments[2].geti32());
+
+        interface.eeiCallDataCopy(resultOffset, dataOffset, length);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getCaller"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        interface.eeiGetCaller(resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getCallValue"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        interface.eeiGetCallValue(resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("codeCopy"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t codeOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t length = static_cast<uint32_t>(arguments[2].geti32());
+
+        interface.eeiCodeCopy(resultOffset, codeOffset, length);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getCodeSize"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetCodeSize());
+      } },
+      { wasm::Name("externalCodeCopy"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t codeOffset = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t length = static_cast<uint32_t>(arguments[3].geti32());
+
+        interface.eeiExternalCodeCopy(addressOffset, resultOffset, codeOffset, length);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getExternalCodeSize"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        return wasm::Literal(interface.eeiGetExternalCodeSize(addressOffset));
+      } },
+      { wasm::Name("getBlockCoinbase"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        interface.eeiGetBlockCoinbase(resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getBlockDifficulty"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
+
+        interface.eeiGetBlockDifficulty(offset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getBlockGasLimit"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetBlockGasLimit());
+      } },
+      { wasm::Name("getTxGasPrice"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t valueOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        interface.eeiGetTxGasPrice(valueOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("log"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t length = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t numberOfTopics = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t topic1 = static_cast<uint32_t>(arguments[3].geti32());
+        uint32_t topic2 = static_cast<uint32_t>(arguments[4].geti32());
+        uint32_t topic3 = static_cast<uint32_t>(arguments[5].geti32());
+        uint32_t topic4 = static_cast<uint32_t>(arguments[6].geti32());
+
+        interface.eeiLog(dataOffset, length, numberOfTopics, topic1, topic2, topic3, topic4);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getBlockNumber"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetBlockNumber());
+      } },
+      { wasm::Name("getBlockTimestamp"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetBlockTimestamp());
+      } },
+      { wasm::Name("getTxOrigin"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        interface.eeiGetTxOrigin(resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("storageStore"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t pathOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t valueOffset = static_cast<uint32_t>(arguments[1].geti32());
+
+        interface.eeiStorageStore(pathOffset, valueOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("storageLoad"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t pathOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[1].geti32());
+
+        interface.eeiStorageLoad(pathOffset, resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("finish"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t size = static_cast<uint32_t>(arguments[1].geti32());
+
+        // This traps.
+        interface.eeiFinish(offset, size);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("revert"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t offset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t size = static_cast<uint32_t>(arguments[1].geti32());
+
+        // This traps.
+        interface.eeiRevert(offset, size);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getReturnDataSize"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetReturnDataSize());
+      } },
+      { wasm::Name("returnDataCopy"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t offset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t size = static_cast<uint32_t>(arguments[2].geti32());
+
+        interface.eeiReturnDataCopy(dataOffset, offset, size);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("call"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        int64_t gas = arguments[0].geti64();
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t valueOffset = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[3].geti32());
+        uint32_t dataLength = static_cast<uint32_t>(arguments[4].geti32());
+
+        return wasm::Literal(interface.eeiCall(EEICallKind::Call, gas, addressOffset, valueOffset, dataOffset, dataLength));
+      } },
+      { wasm::Name("callCode"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        int64_t gas = arguments[0].geti64();
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t valueOffset = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[3].geti32());
+        uint32_t dataLength = static_cast<uint32_t>(arguments[4].geti32());
+
+        return wasm::Literal(interface.eeiCall(EEICallKind::CallCode, gas, addressOffset, valueOffset, dataOffset, dataLength));
+      } },
+      { wasm::Name("callDelegate"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        int64_t gas = arguments[0].geti64();
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t dataLength = static_cast<uint32_t>(arguments[3].geti32());
+
+        return wasm::Literal(interface.eeiCall(EEICallKind::CallDelegate, gas, addressOffset, 0, dataOffset, dataLength));
+      } },
+      { wasm::Name("callStatic"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        int64_t gas = arguments[0].geti64();
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t dataLength = static_cast<uint32_t>(arguments[3].geti32());
+
+        return wasm::Literal(interface.eeiCall(EEICallKind::CallStatic, gas, addressOffset, 0, dataOffset, dataLength));
+      } },
+      { wasm::Name("create"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t valueOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t length = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[3].geti32());
+
+        return wasm::Literal(interface.eeiCreate(valueOffset, dataOffset, length, resultOffset));
+      } },
+      { wasm::Name("selfDestruct"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        // This traps.
+        interface.eeiSelfDestruct(addressOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getExternalCodeHash"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t addressOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t resultOffset  = static_cast<uint32_t>(arguments[1].geti32());
+
+        interface.eeiGetExternalCodeHash(addressOffset, resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getChainID"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetChainID());
+      } },
+      { wasm::Name("getSelfBalance"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[0].geti32());
+
+        interface.eeiGetSelfBalance(resultOffset);
+
+        return wasm::Literal();
+      } },
+      { wasm::Name("getBasefee"), [](BinaryenEthereumInterface& interface, wasm::LiteralList&) {
+        return wasm::Literal(interface.eeiGetBasefee());
+      } },
+      { wasm::Name("create2"), [](BinaryenEthereumInterface& interface, wasm::LiteralList& arguments) {
+        uint32_t valueOffset = static_cast<uint32_t>(arguments[0].geti32());
+        uint32_t dataOffset = static_cast<uint32_t>(arguments[1].geti32());
+        uint32_t length = static_cast<uint32_t>(arguments[2].geti32());
+        uint32_t saltOffset = static_cast<uint32_t>(arguments[3].geti32());
+        uint32_t resultOffset = static_cast<uint32_t>(arguments[4].geti32());
+
+        return wasm::Literal(interface.eeiCreate2(valueOffset, dataOffset, length, saltOffset, resultOffset));
+      } },
+    };
+
+    auto it = functions.find(import.base);
+    return (it != functions.end()) ? it->second : nullptr;
+  }
 
-      eeiGetSelfBalance(resultOffset);
-      return wasm::Literal();
-<<<<<<< HEAD
-    }
+  wasm::Literal BinaryenHostInterface::callImport(wasm::Import *import, wasm::LiteralList& arguments) {
+    heraAssert(m_interface, "Host function called outside of an execution.");
+    // Every import of the module was replaced by an IndexedImport in prepare().
+    ImportFunction function = m_module.imports[static_cast<IndexedImport const*>(import)->index];
+    heraAssert(function, string("Unsupported import called: ") + import->module.str + "::" + import->base.str + " (" + to_string(arguments.size()) + " arguments)");
+    if (!m_module.nativeMetering)
+      return function(*m_interface, arguments);
+
+    storeGasCounter();
+    wasm::Literal ret = function(*m_interface, arguments);
+    loadGasCounter();
+    return ret;
+  }
 
-=======
-    }   
-  
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
-    if (import->base == wasm::Name("getBasefee")) {
-      heraAssert(arguments.size() == 0, string("Argument count mismatch in: ") + import->base.str);
-      return wasm::Literal(eeiGetBasefee());
-    }
+unique_ptr<WasmEngine> BinaryenEngine::create()
+{
+  return unique_ptr<WasmEngine>{new BinaryenEngine};
+}
 
-    if (import->base == wasm::Name("create2")) {
-      heraAssert(arguments.size() == 5, string("Argument count mismatch in: ") + import->base.str);
+shared_ptr<PreparedModule const> BinaryenEngine::prepare(vector<uint8_t> const& code)
+{
+  auto module = make_shared<BinaryenModule>();
+  module->codeSize = code.size();
+
+  lock_guard<mutex> lock(parserMutex);
+
+  // Load module, metered in the same blocks and at the same cost as by the Sentinel
+  if (m_nativeMetering) {
+    loadModule(injectMetering(code, MeteringCharge::Counter), module->module);
+    // The counter is appended after the globals of the contract.
+    module->gasCounter = module->module.globals.back()->name;
+    module->nativeMetering = true;
+  } else {
+    loadModule(code, module->module);
+  }
 
-      uint32_t valueOffset = static_cast<uint32_t>(arguments[0].geti32());
-      uint32_t dataOffset = static_cast<uint32_t>(arguments[1].geti32());
-      uint32_t length = static_cast<uint32_t>(arguments[2].geti32());
-      uint32_t saltOffset = static_cast<uint32_t>(arguments[3].geti32());
-      uint32_t resultOffset = static_cast<uint32_t>(arguments[4].geti32());
+  // Print
+  // WasmPrinter::printModule(module->module);
 
-      return wasm::Literal(eeiCreate2(valueOffset, dataOffset, length, saltOffset, resultOffset));
-    }
+  // Validate
+  verifyContract(module->module);
+
+  // The snapshot keeps the pages written by data segments, each may straddle one more page.
+  size_t segmentPages = 0;
+  for (auto const& segment: module->module.memory.segments)
+    segmentPages += (segment.data.size() + 4095) / 4096 + 1;
+  size_t memorySize = static_cast<size_t>(module->module.memory.initial) * wasm::Memory::kPageSize;
+  module->snapshotSize = min(segmentPages * 4096, memorySize) + module->module.table.initial * sizeof(wasm::Name);
+
+  // Resolve the imports into a table, so that host calls need no lookups
+  vector<wasm::Import*> indexed;
+  for (auto const& import: module->module.imports) {
+    module->imports.push_back(BinaryenEthereumInterface::resolveImport(*import));
+    indexed.push_back(new IndexedImport(*import, indexed.size()));
+  }
+  for (wasm::Import* import: indexed) {
+    module->module.removeImport(import->name);
+    module->module.addImport(import);
+  }
+  module->importsIndexed = true;
 
-<<<<<<< HEAD
+  // NOTE: DO NOT use the optimiser here, it will conflict with metering
 
-=======
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
-    heraAssert(false, string("Unsupported import called: ") + import->module.str + "::" + import->base.str + " (" + to_string(arguments.size()) + "arguments)");
-  }
+  return module;
+}
 
-unique_ptr<WasmEngine> BinaryenEngine::create()
+unique_ptr<WasmInstance> BinaryenEngine::instantiate(shared_ptr<PreparedModule const> module)
 {
-  return unique_ptr<WasmEngine>{new BinaryenEngine};
+  auto binaryenModule = dynamic_pointer_cast<BinaryenModule const>(module);
+  heraAssert(binaryenModule, "Module was not prepared by Binaryen.");
+  return unique_ptr<WasmInstance>{new BinaryenInstance(move(binaryenModule))};
 }
 
 // Execute the contract through Binaryen.
-ExecutionResult BinaryenEngine::execute(
+ExecutionResult BinaryenInstance::run(
   evmc_context* context,
-  vector<uint8_t> const& code,
   vector<uint8_t> const& state_code,
   evmc_message const& msg,
   bool meterInterfaceGas
 ) {
-  wasm::Module module;
-
-  // Load module
-  loadModule(code, module);
-
-  // Print
-  // WasmPrinter::printModule(module);
-
-  // Validate
-  verifyContract(module);
-
-  // NOTE: DO NOT use the optimiser here, it will conflict with metering
-
-  // Interpret
   ExecutionResult result;
-  BinaryenEthereumInterface interface(context, state_code, msg, result, meterInterfaceGas);
-  wasm::ModuleInstance instance(module, &interface);
+  BinaryenEthereumInterface interface(context, state_code, msg, result, meterInterfaceGas, m_host);
+  m_host.bind(&interface, &result);
+  if (m_module->nativeMetering)
+    m_host.loadGasCounter();
 
+  // Interpret
   try {
-    wasm::Name main = wasm::Name("main");
     wasm::LiteralList args;
-    instance.callExport(main, args);
+    m_instance.callExport(mainExportName, args);
+    // Ending the execution in a host function leaves the gas left in the result.
+    if (m_module->nativeMetering)
+      m_host.storeGasCounter();
   } catch (EndExecution const&) {
     // This exception is ignored here because we consider it to be a success.
     // It is only a clutch for POSIX style exit()
+    // This engine keeps the default endExecution(), see EthereumInterface.
+  } catch (...) {
+    m_host.bind(nullptr, nullptr);
+    throw;
   }
 
+  m_host.bind(nullptr, nullptr);
+  interface.flushStorage();
   return result;
 }
 
@@ -576,6 +699,7 @@ void BinaryenEngine::loadModule(vector<uint8_t> const& code, wasm::Module & modu
 
 void BinaryenEngine::verifyContract(vector<uint8_t> const& code)
 {
+  lock_guard<mutex> lock(parserMutex);
   wasm::Module module;
   loadModule(code, module);
   verifyContract(module);
@@ -674,20 +798,11 @@ void BinaryenEngine::verifyContract(wasm::Module & module)
     { wasm::Name("callStatic"), createFunctionType({ wasm::Type::i64, wasm::Type::i32, wasm::Type::i32, wasm::Type::i32 }, wasm::Type::i32) },
     { wasm::Name("create"), createFunctionType({ wasm::Type::i32, wasm::Type::i32, wasm::Type::i32, wasm::Type::i32 }, wasm::Type::i32) },
     { wasm::Name("selfDestruct"), createFunctionType({ wasm::Type::i32 }, wasm::Type::none) },
-<<<<<<< HEAD
-    { wasm::Name("create2"), createFunctionType({ wasm::Type::i32, wasm::Type::i32, wasm::Type::i32, wasm::Type::i32, wasm::Type::i32 },wasm::Type::i32) },
-    { wasm::Name("getExternalCodeHash"), createFunctionType({ wasm::Type::i32, wasm::Type::i32}, wasm::Type::none) },
-    { wasm::Name("getChainID"), createFunctionType({}, wasm::Type::i64) },
-    { wasm::Name("getSelfBalance"), createFunctionType({ wasm::Type::i32}, wasm::Type::none) },
-    { wasm::Name("getBasefee"), createFunctionType({}, wasm::Type::i64) }
-=======
-
     { wasm::Name("create2"), createFunctionType({ wasm::Type::i32, wasm::Type::i32, wasm::Type::i32, wasm::Type::i32, wasm::Type::i32 }, wasm::Type::i32) },
     { wasm::Name("getExternalCodeHash"), createFunctionType({ wasm::Type::i32, wasm::Type::i32}, wasm::Type::none) },
     { wasm::Name("getChainID"), createFunctionType({}, wasm::Type::i64) },
     { wasm::Name("getSelfBalance"), createFunctionType({ wasm::Type::i32}, wasm::Type::none) },
-    { wasm::Name("getBasefee"), createFunctionType({}, wasm::Type::i64) },
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
+    { wasm::Name("getBasefee"), createFunctionType({}, wasm::Type::i64) }
   };
 
   for (auto const& import: module.imports) {
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <memory>
+
 #include "eei.h"
 
 namespace wasm {
@@ -29,22 +31,25 @@ public:
   /// Factory method to create the Binaryen Wasm Engine.
   static std::unique_ptr<WasmEngine> create();
 
-  ExecutionResult execute(
-    evmc_context* context,
-    std::vector<uint8_t> const& code,
-    std::vector<uint8_t> const& state_code,
-    evmc_message const& msg,
-    bool meterInterfaceGas
-  ) override;
+  std::shared_ptr<PreparedModule const> prepare(std::vector<uint8_t> const& code) override;
+
+  std::unique_ptr<WasmInstance> instantiate(std::shared_ptr<PreparedModule const> module) override;
 
   void verifyContract(std::vector<uint8_t> const& code) override;
 
+  bool setNativeMetering(bool enabled) override {
+    m_nativeMetering = enabled;
+    return true;
+  }
+
 private:
   void verifyContract(wasm::Module & module);
 
   /// Parses and loads a Wasm module.
   /// Don't ask, Module has no copy constructor, hence the reference.
   void loadModule(std::vector<uint8_t> const& code, wasm::Module & module);
+
+  bool m_nativeMetering = false;
 };
 
 }
@@ -0,0 +1,190 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "helpers.h"
+#include "shared-mutex.h"
+
+namespace hera {
+
+struct CacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t evictions = 0;
+  size_t entries = 0;
+  size_t size = 0;
+  size_t capacity = 0;
+};
+
+/// A bounded least-recently-used cache of values derived from a piece of code.
+///
+/// Entries are content-addressed: they are looked up by a hash of the code,
+/// but the code itself is kept and compared as well, so a hash collision can
+/// never return a value derived from different code. The optional @tag takes
+/// part in the key and distinguishes values derived from the same code in
+/// different ways (e.g. with or without tracing).
+///
+/// The budget is accounted in bytes, using the cost supplied on insertion plus
+/// the size of the stored key. Values are handed out as shared pointers, so
+/// evicting an entry never invalidates a value which is still in use.
+///
+/// All methods are thread-safe. Lookups only take the lock in shared mode, so
+/// concurrent hits do not serialize: a hit marks its entry as used instead of
+/// moving it to the front. Recency is approximated when evicting: the oldest
+/// entry is given a second chance, moved to the front, if it was used since
+/// it got there (the clock algorithm).
+template <typename Value>
+class CodeCache {
+public:
+  explicit CodeCache(size_t _capacity): m_capacity(_capacity) {}
+
+  CodeCache(CodeCache const&) = delete;
+  CodeCache& operator=(CodeCache const&) = delete;
+
+  std::shared_ptr<Value> find(std::vector<uint8_t> const& code, uint64_t tag = 0)
+  {
+    uint64_t hash = hashBytes(code.data(), code.size(), tag);
+    SharedLock lock(m_mutex);
+    auto range = m_index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      Entry const& entry = *it->second;
+      if (entry.tag == tag && entry.code == code) {
+        m_hits.fetch_add(1, std::memory_order_relaxed);
+        entry.used.store(true, std::memory_order_relaxed);
+        return entry.value;
+      }
+    }
+    m_misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  void insert(std::vector<uint8_t> const& code, std::shared_ptr<Value> value, size_t cost, uint64_t tag = 0)
+  {
+    uint64_t hash = hashBytes(code.data(), code.size(), tag);
+    std::lock_guard<SharedMutex> lock(m_mutex);
+    // Replace any existing entry for the same key.
+    auto range = m_index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second->tag == tag && it->second->code == code) {
+        erase(it);
+        break;
+      }
+    }
+
+    cost += code.size();
+    if (cost > m_capacity)
+      return;
+
+    while (m_size + cost > m_capacity)
+      evictOldest();
+
+    m_entries.emplace_front(hash, tag, code, std::move(value), cost);
+    m_index.emplace(hash, m_entries.begin());
+    m_size += cost;
+  }
+
+  void setCapacity(size_t _capacity)
+  {
+    std::lock_guard<SharedMutex> lock(m_mutex);
+    m_capacity = _capacity;
+    while (m_size > m_capacity)
+      evictOldest();
+  }
+
+  void clear()
+  {
+    std::lock_guard<SharedMutex> lock(m_mutex);
+    m_index.clear();
+    m_entries.clear();
+    m_size = 0;
+  }
+
+  CacheStats stats() const
+  {
+    SharedLock lock(m_mutex);
+    CacheStats ret = m_stats;
+    ret.hits = m_hits.load(std::memory_order_relaxed);
+    ret.misses = m_misses.load(std::memory_order_relaxed);
+    ret.entries = m_entries.size();
+    ret.size = m_size;
+    ret.capacity = m_capacity;
+    return ret;
+  }
+
+private:
+  struct Entry {
+    Entry(uint64_t _hash, uint64_t _tag, std::vector<uint8_t> const& _code, std::shared_ptr<Value> _value, size_t _cost):
+      hash(_hash), tag(_tag), code(_code), value(std::move(_value)), cost(_cost)
+    {}
+
+    uint64_t hash;
+    uint64_t tag;
+    std::vector<uint8_t> code;
+    std::shared_ptr<Value> value;
+    size_t cost;
+    // Set by a hit, cleared when the entry gets its second chance.
+    mutable std::atomic<bool> used{false};
+  };
+
+  using EntryList = std::list<Entry>;
+  using Index = std::unordered_multimap<uint64_t, typename EntryList::iterator>;
+
+  // Must be called with the lock held exclusively.
+  void evictOldest()
+  {
+    while (m_entries.back().used.exchange(false, std::memory_order_relaxed))
+      m_entries.splice(m_entries.begin(), m_entries, std::prev(m_entries.end()));
+
+    Entry const& oldest = m_entries.back();
+    auto range = m_index.equal_range(oldest.hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (&*it->second == &oldest) {
+        erase(it);
+        m_stats.evictions++;
+        return;
+      }
+    }
+  }
+
+  void erase(typename Index::iterator it)
+  {
+    m_size -= it->second->cost;
+    m_entries.erase(it->second);
+    m_index.erase(it);
+  }
+
+  mutable SharedMutex m_mutex;
+  EntryList m_entries;
+  Index m_index;
+  size_t m_capacity = 0;
+  size_t m_size = 0;
+  // Only the evictions, the other fields are filled in by stats().
+  CacheStats m_stats;
+  std::atomic<uint64_t> m_hits{0};
+  std::atomic<uint64_t> m_misses{0};
+};
+
+}
@@ -14,12 +14,13 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <vector>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
-#include<fstream>
 
 // #include <vector>
 #include <sstream>
@@ -30,12 +31,15 @@
 #include "eei.h"
 #include "exceptions.h"
 #include "helpers.h"
+#include "primitives.h"
+#include "trace.h"
 
 #include <evmc/instructions.h>
 
 using namespace std;
 
 namespace hera {
+
 #if HERA_DEBUGGING
   void EthereumInterface::debugPrintMem(bool useHex, uint32_t offset, uint32_t length)
   {
@@ -47,14 +51,14 @@ namespace hera {
       {
         cerr << hex;
         for (uint32_t i = offset; i < (offset + length); i++) {
-          cerr << static_cast<int>(memoryGet(i)) << " ";
+          cerr << static_cast<int>(memoryData()[i]) << " ";
         }
         cerr << dec;
       }
       else
       {
         for (uint32_t i = offset; i < (offset + length); i++) {
-          cerr << memoryGet(i) << " ";
+          cerr << memoryData()[i] << " ";
         }
       }
       cerr << endl;
@@ -72,7 +76,7 @@ namespace hera {
 
       HERA_DEBUG << "): " << dec;
 
-      evmc_bytes32 result = m_context->host->get_storage(m_context, &m_msg.destination, &path);
+      evmc_bytes32 result = loadStorage(path);
 
       if (useHex)
       {
@@ -194,30 +198,14 @@ namespace hera {
       HERA_DEBUG << "callDataCopy " << hex << resultOffset << " " << dataOffset << " " << length << dec << "\n";
 
       safeChargeDataCopy(length, GasSchedule::verylow);
-<<<<<<< HEAD
-
-      // storeMemory({m_msg.input_data, m_msg.input_size}, dataOffset, resultOffset, length);
 
-      // vector<uint8_t> input(m_msg.input_data, m_msg.input_data + m_msg.input_size);
-      if (dataOffset + length <= m_msg.input_size)
-      {
-        storeMemory({m_msg.input_data, m_msg.input_size}, dataOffset, resultOffset, length);
-      } else{
-        storeMemory({m_msg.input_data, m_msg.input_size}, dataOffset, resultOffset, static_cast<uint32_t>(m_msg.input_size)-dataOffset);
-      }
-=======
-      
-      vector<uint8_t> input(m_msg.input_data, m_msg.input_data + m_msg.input_size);
       if (dataOffset + length <= m_msg.input_size)
       {
-        storeMemory(input, dataOffset, resultOffset, length);
+        storeMemory(m_msg.input_data, m_msg.input_size, dataOffset, resultOffset, length);
       } else{
-        storeMemory(input, dataOffset, resultOffset, static_cast<uint32_t>(m_msg.input_size)-dataOffset);
+        storeMemory(m_msg.input_data, m_msg.input_size, dataOffset, resultOffset, static_cast<uint32_t>(m_msg.input_size)-dataOffset);
       }
       HERA_DEBUG << "callDataCopy end.\n";
-      //vector<uint8_t> input(m_msg.input_data, m_msg.input_data + m_msg.input_size);
-      //storeMemory(input, dataOffset, resultOffset, length);
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
   }
 
   void EthereumInterface::eeiGetCaller(uint32_t resultOffset)
@@ -270,12 +258,10 @@ namespace hera {
       safeChargeDataCopy(length, GasSchedule::extcode);
 
       evmc_address address = loadAddress(addressOffset);
-      // FIXME: optimise this so no vector needs to be created
-      vector<uint8_t> codeBuffer(length);
-      size_t numCopied = m_context->host->copy_code(m_context, &address, codeOffset, codeBuffer.data(), codeBuffer.size());
+      // The code is copied straight into the memory.
+      uint8_t* dst = destinationMemory(resultOffset, length);
+      size_t numCopied = m_context->host->copy_code(m_context, &address, codeOffset, dst, length);
       ensureCondition(numCopied == length, InvalidMemoryAccess, "Out of bounds (source) memory copy");
-
-      storeMemory(codeBuffer, 0, resultOffset, length);
   }
 
   uint32_t EthereumInterface::eeiGetExternalCodeSize(uint32_t addressOffset)
@@ -347,18 +333,6 @@ namespace hera {
 
       ensureCondition(numberOfTopics <= 4, ContractValidationFailure, "Too many topics specified");
 
-<<<<<<< HEAD
-      // TODO: should this assert that unused topic offsets must be 0?
-      array<evmc::uint256be, 4> topics;
-      topics[0] = (numberOfTopics >= 1) ? loadBytes32(topic1) : evmc::uint256be{};
-      topics[1] = (numberOfTopics >= 2) ? loadBytes32(topic2) : evmc::uint256be{};
-      topics[2] = (numberOfTopics >= 3) ? loadBytes32(topic3) : evmc::uint256be{};
-      topics[3] = (numberOfTopics == 4) ? loadBytes32(topic4) : evmc::uint256be{};
-
-
-      std::ofstream logfp;
-      logfp.open("/txtracetmp", ios::app);
-=======
       // FIXME: should this assert that unused topic offsets must be 0?
       array<evmc_uint256be, 4> topics;
       topics[0] = (numberOfTopics >= 1) ? loadBytes32(topic1) : evmc_uint256be{};
@@ -366,28 +340,20 @@ namespace hera {
       topics[2] = (numberOfTopics >= 3) ? loadBytes32(topic3) : evmc_uint256be{};
       topics[3] = (numberOfTopics == 4) ? loadBytes32(topic4) : evmc_uint256be{};
 
-
-      std::ofstream logfp;
-      logfp.open("/txtracetmp", ios::app);  
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
-      logfp << "LOG: " << hex << dataOffset << " " << hex << length;
-      for (uint32_t i = 0; i< numberOfTopics; i++) {
-        logfp << " ";
-        for (int j = 0;j < 32; j++)
-          logfp << std::setfill('0') << setw(2) << hex << (int)(*(topics[i].bytes+j));
+      if (m_trace) {
+        TraceRecord record{};
+        record.event = TraceEvent::Log;
+        record.account = m_msg.destination;
+        record.numberOfTopics = static_cast<uint8_t>(numberOfTopics);
+        record.dataOffset = dataOffset;
+        record.length = length;
+        copy(topics.begin(), topics.end(), record.words);
+        traceRecord(record);
       }
-      logfp << "\n";
-      logfp.close();
-<<<<<<< HEAD
 
-=======
-    
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
-      ensureSourceMemoryBounds(dataOffset, length);
-      vector<uint8_t> data(length);
-      loadMemory(dataOffset, data, length);
+      uint8_t const* data = sourceMemory(dataOffset, length);
 
-      m_context->host->emit_log(m_context, &m_msg.destination, data.data(), length, topics.data(), numberOfTopics);
+      m_context->host->emit_log(m_context, &m_msg.destination, data, length, topics.data(), numberOfTopics);
   }
 
   int64_t EthereumInterface::eeiGetBlockNumber()
@@ -438,18 +404,16 @@ namespace hera {
 
       evmc_bytes32 path = loadBytes32(pathOffset);
       evmc_bytes32 value = loadBytes32(valueOffset);
-      evmc_bytes32 current = m_context->host->get_storage(m_context, &m_msg.destination, &path);
-
-      std::ofstream logfp;
-      logfp.open("/txtracetmp", ios::app);  
-      logfp << "SSTORE: ";
-      for (int i = 0;i < 32; i++)
-        logfp << std::setfill('0') << setw(2) << hex << (int)(*(path.bytes+i));
-      logfp << " ";
-      for (int i = 0;i < 32; i++)
-        logfp << std::setfill('0') << setw(2) << hex << (int)(*(value.bytes+i));
-      logfp << "\n";
-      logfp.close();
+      evmc_bytes32 current = loadStorage(path);
+
+      if (m_trace) {
+        TraceRecord record{};
+        record.event = TraceEvent::StorageStore;
+        record.account = m_msg.destination;
+        record.words[0] = path;
+        record.words[1] = value;
+        traceRecord(record);
+      }
 
       HERA_DEBUG << "storageStore: slot=";
       for (int i = 0;i < 32; i++)
@@ -460,27 +424,26 @@ namespace hera {
         HERA_DEBUG << std::setfill('0') << setw(2) << hex << (int)(*(value.bytes+i));
       HERA_DEBUG << "\n";
 
-
-      std::ofstream logfp;
-      logfp.open("/txtracetmp", ios::app);
-      logfp << "SSTORE: ";
-      for (int i = 0;i < 32; i++)
-        logfp << std::setfill('0') << setw(2) << hex << (int)(*(path.bytes+i));
-      logfp << " ";
-      for (int i = 0;i < 32; i++)
-        logfp << std::setfill('0') << setw(2) << hex << (int)(*(value.bytes+i));
-      logfp << "\n";
-      logfp.close();
-
-
-
       // Charge the right amount in case of the create case.
       if (isZeroUint256(current) && !isZeroUint256(value))
         takeInterfaceGas(GasSchedule::storageStoreCreate - GasSchedule::storageStoreChange);
 
       // We do not need to take care about the delete case (gas refund), the client does it.
-
-      m_context->host->set_storage(m_context, &m_msg.destination, &path, &value);
+      // The client refunds clearing a slot and, with net gas metering, restoring its
+      // value. These writes are passed on at once, after a pending write of the slot,
+      // so that the client sees the transitions it refunds. Other writes are combined.
+      StorageSlot& slot = m_storage[path];
+      Bytes32Equal equal;
+      if (isZeroUint256(value) || equal(value, slot.stored)) {
+        if (!equal(slot.value, slot.stored))
+          m_context->host->set_storage(m_context, &m_msg.destination, &path, &slot.value);
+        m_context->host->set_storage(m_context, &m_msg.destination, &path, &value);
+        slot = StorageSlot{value, value};
+      } else {
+        if (equal(slot.value, slot.stored))
+          m_pendingSlots.push_back(path);
+        slot.value = value;
+      }
   }
 
   void EthereumInterface::eeiStorageLoad(uint32_t pathOffset, uint32_t resultOffset)
@@ -488,26 +451,17 @@ namespace hera {
       HERA_DEBUG << "storageLoad " << hex << pathOffset << " " << resultOffset << dec << "\n";
       takeInterfaceGas(GasSchedule::storageLoad);
 
-<<<<<<< HEAD
-      evmc::bytes32 path = loadBytes32(pathOffset);
-    
-      std::ofstream logfp;
-      logfp.open("/txtracetmp", ios::app);
-=======
       evmc_bytes32 path = loadBytes32(pathOffset);
 
-      std::ofstream logfp;
-      logfp.open("/txtracetmp", ios::app);  
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
-      logfp << "SLOAD: ";
-      for (int i = 0;i < 32; i++)
-        logfp << std::setfill('0') << setw(2) << hex << (int)(*(path.bytes+i));
-      logfp << "\n";
-      logfp.close();
-<<<<<<< HEAD
-=======
-      
-      evmc_bytes32 result = m_context->host->get_storage(m_context, &m_msg.destination, &path);
+      if (m_trace) {
+        TraceRecord record{};
+        record.event = TraceEvent::StorageLoad;
+        record.account = m_msg.destination;
+        record.words[0] = path;
+        traceRecord(record);
+      }
+
+      evmc_bytes32 result = loadStorage(path);
 
       //  std::cerr << std::setfill('0') << std::setw(2) << hex << (int)(*(m_msg.input_data+i)) << "";
       HERA_DEBUG << "storageLoad: slot=";
@@ -518,9 +472,7 @@ namespace hera {
       for (int i = 0;i < 32; i++)
         HERA_DEBUG << std::setfill('0') << setw(2) << hex << (int)(*(result.bytes+i));
       HERA_DEBUG << "\n";
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
 
-      evmc::bytes32 result = m_host.get_storage(m_msg.destination, path);
       storeBytes32(result, resultOffset);
   }
 
@@ -547,7 +499,15 @@ namespace hera {
 
       m_result.isRevert = revert;
 
-      throw EndExecution{};
+      // The client discards the changes of a reverted execution.
+      if (revert) {
+        m_storage.clear();
+        m_pendingSlots.clear();
+      } else {
+        flushStorage();
+      }
+
+      endExecution();
   }
 
   uint32_t EthereumInterface::eeiGetReturnDataSize()
@@ -565,9 +525,6 @@ namespace hera {
       safeChargeDataCopy(size, GasSchedule::verylow);
 
       storeMemory(m_lastReturnData, offset, dataOffset, size);
-<<<<<<< HEAD
-      
-=======
 
       HERA_DEBUG << "\nm_lastReturn = " ;
       for (uint32_t i=0; i < size; i++)
@@ -575,10 +532,9 @@ namespace hera {
       
       HERA_DEBUG << "\n Mem Content:";
       for (uint32_t i = 0; i < size; ++i) {
-        HERA_DEBUG << hex << static_cast<int>(memoryGet(dataOffset + i)) << " ";
+        HERA_DEBUG << hex << static_cast<int>(memoryData()[dataOffset + i]) << " ";
       }
       HERA_DEBUG << "\n";
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
   }
 
   uint32_t EthereumInterface::eeiCall(EEICallKind kind, int64_t gas, uint32_t addressOffset, uint32_t valueOffset, uint32_t dataOffset, uint32_t dataLength)
@@ -590,39 +546,21 @@ namespace hera {
       call_message.flags = m_msg.flags & EVMC_STATIC;
       call_message.depth = m_msg.depth + 1;
 
-      std::ofstream logfp;
-<<<<<<< HEAD
-      logfp.open("/txtracetmp", ios::app);
-=======
-      logfp.open("/txtracetmp", ios::app);  
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
-      switch (kind) {
-      case EEICallKind::Call: logfp << "CALL: \n"; break;
-      case EEICallKind::CallCode: logfp << "CALLCODE: \n"; break;
-      case EEICallKind::CallDelegate: logfp << "CALLDELEGATE: \n"; break;
-<<<<<<< HEAD
-      case EEICallKind::CallStatic:
-          uint8_t t[20] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09};
-          if (std::equal(std::begin(t), std::end(t), std::begin(call_message.destination.bytes))) {
-            // logfp << "SHA3:\n";
-=======
-      case EEICallKind::CallStatic: 
-          uint8_t t[20] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09};
-          if (std::equal(std::begin(t), std::end(t), std::begin(call_message.destination.bytes))) {
-            // logfp << "SHA3:\n"; 
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
-            break;
-          } else {
-            logfp << "CALLSTATIC: \n"; break;
-          }
+      if (m_trace) {
+        TraceRecord record{};
+        record.account = m_msg.destination;
+        switch (kind) {
+        case EEICallKind::Call: record.event = TraceEvent::Call; break;
+        case EEICallKind::CallCode: record.event = TraceEvent::CallCode; break;
+        case EEICallKind::CallDelegate: record.event = TraceEvent::CallDelegate; break;
+        case EEICallKind::CallStatic: record.event = TraceEvent::CallStatic; break;
+        }
+        // Static calls to the SHA3 contract (0x00..09) are not traced.
+        static constexpr uint8_t sha3Address[20] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x09};
+        if (kind != EEICallKind::CallStatic || !std::equal(std::begin(sha3Address), std::end(sha3Address), std::begin(call_message.destination.bytes)))
+          traceRecord(record);
       }
-      // logfp << hex << dataOffset  << " " << hex << dataLength << "\n";
-      logfp.close();
-<<<<<<< HEAD
 
-=======
-    
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
       switch (kind) {
       case EEICallKind::Call:
       case EEICallKind::CallCode:
@@ -673,13 +611,9 @@ namespace hera {
       
 // #endif
 
-      // NOTE: this must be declared outside the condition to ensure the memory doesn't go out of scope
-      vector<uint8_t> input_data;
       if (dataLength) {
-        ensureSourceMemoryBounds(dataOffset, dataLength);
-        input_data.resize(dataLength);
-        loadMemory(dataOffset, input_data, dataLength);
-        call_message.input_data = input_data.data();
+        // The callee runs in a separate instance, so the input can be passed from our memory.
+        call_message.input_data = sourceMemory(dataOffset, dataLength);
         call_message.input_size = dataLength;
       } else {
         call_message.input_data = nullptr;
@@ -730,6 +664,7 @@ namespace hera {
         gas += GasSchedule::valueStipend;
 
       call_message.gas = gas;
+      flushStorage();
       evmc_result call_result = m_context->host->call(m_context, &call_message);
       HERA_DEBUG << "return status = " << call_result.status_code << "\n";
       if (call_result.output_data) {
@@ -818,6 +753,7 @@ namespace hera {
       }
       HERA_DEBUG << "\n";
 
+      flushStorage();
       evmc_result create_result = m_context->host->call(m_context, &create_message);
 
       /* Return unspent gas */
@@ -919,6 +855,7 @@ namespace hera {
       create_message.gas = gas;
       takeInterfaceGas(gas);
 
+      flushStorage();
       evmc_result create_result = m_context->host->call(m_context, &create_message);
 
       /* Return unspent gas */
@@ -948,110 +885,16 @@ namespace hera {
       }
   }
 
-  uint32_t EthereumInterface::eeiCreate2(uint32_t valueOffset, uint32_t dataOffset, uint32_t length, uint32_t saltOffset, uint32_t resultOffset)
-  {
-      HERA_DEBUG << "create2 " << hex << valueOffset << " " << dataOffset << " " << length << dec << " " << dec << saltOffset << " " << resultOffset << dec << "\n";
-
-      takeInterfaceGas(GasSchedule::create2);
-
-     ensureCondition(!(m_msg.flags & EVMC_STATIC), StaticModeViolation, "create2");
-      evmc_message create_message;
-
-      create_message.destination = {};
-      create_message.sender = m_msg.destination;
-      create_message.value = loadUint128(valueOffset);
-      create_message.create2_salt = loadBytes32(saltOffset);
-
-
-      // std::ofstream logfp;
-      // logfp.open("/txtracetmp", ios::app);
-      // logfp << "CREATE2: " << hex << dataOffset << " " << hex << length << "\n";
-      // // for (int i = 0;i < 32; i++)
-      // //   logfp << std::setfill('0') << setw(2) << hex << (int)(*(create_message.value.bytes+i));
-      // for (int i = 0;i < 32; i++)
-      //   logfp << std::setfill('0') << setw(2) << hex << static_cast<int>(create_message.create2_salt.bytes[32 - (i + 1)]);
-      // logfp.close();
-
-      HERA_DEBUG << "Salt :: ";
-      for (uint32_t i = 0; i < 32; ++i) {
-          HERA_DEBUG << hex << static_cast<int>(create_message.create2_salt.bytes[32 - (i + 1)]) << " ";
-      }
-      HERA_DEBUG << "\n";
-      // HERA_DEBUG << "Value :: " << create_message.value << "\n";
-
-
-      if (m_msg.depth >= 1024)
-        return 1;
-      if (!enoughSenderBalanceFor(create_message.value))
-        return 1;
-
-      // NOTE: this must be declared outside the condition to ensure the memory doesn't go out of scope
-      bytes contract_code;
-      if (length) {
-        ensureSourceMemoryBounds(dataOffset, length);
-        contract_code.resize(length);
-        loadMemory(dataOffset, contract_code, length);
-        create_message.input_data = contract_code.data();
-        create_message.input_size = length;
-      } else {
-        create_message.input_data = nullptr;
-        create_message.input_size = 0;
-      }
-
-      HERA_DEBUG << "ContractCode @" << contract_code.size() << ":: ";
-      for (uint32_t i = 0; i < contract_code.size(); ++i) {
-          HERA_DEBUG << hex << static_cast<int>(create_message.input_data[i]) << " ";
-      }
-      HERA_DEBUG << "\n";
-
-
-      create_message.depth = m_msg.depth + 1;
-      create_message.kind = EVMC_CREATE2;
-      create_message.flags = 0;
-
-      int64_t gas = maxCallGas(m_result.gasLeft);
-      create_message.gas = gas;
-      takeInterfaceGas(gas);
-
-      auto create_result = m_host.call(create_message);
-
-       /* Return unspent gas */
-       heraAssert(create_result.gas_left >= 0, "EVMC returned negative gas left");
-       m_result.gasLeft += create_result.gas_left;
-
-      HERA_DEBUG << "Status ::: " << create_result.status_code << "\n";
-       if (create_result.status_code == EVMC_SUCCESS) {
-         storeAddress(create_result.create_address, resultOffset);
-         m_lastReturnData.clear();
-       }
-      
-      // if (create_result.release)
-      //    create_result.release(&create_result);
-
-      switch (create_result.status_code) {
-      case EVMC_SUCCESS:
-        return 0;
-      case EVMC_REVERT:
-        return 2;
-      default:
-        return 1;
-      }
-  }
-
-
   void EthereumInterface::eeiSelfDestruct(uint32_t addressOffset)
   {
       HERA_DEBUG << "selfDestruct " << hex << addressOffset << dec << "\n";
 
-      std::ofstream logfp;
-      logfp.open("/txtracetmp", ios::app);  
-      logfp << "SUICIDE: \n";
-      logfp.close();
-
-      std::ofstream logfp;
-      logfp.open("/txtracetmp", ios::app);
-      logfp << "SUICIDE: \n";
-      logfp.close();
+      if (m_trace) {
+        TraceRecord record{};
+        record.event = TraceEvent::SelfDestruct;
+        record.account = m_msg.destination;
+        traceRecord(record);
+      }
 
       takeInterfaceGas(GasSchedule::selfdestruct);
 
@@ -1062,9 +905,10 @@ namespace hera {
       if (!m_context->host->account_exists(m_context, &address))
         takeInterfaceGas(GasSchedule::callNewAccount);
 
+      flushStorage();
       m_context->host->selfdestruct(m_context, &m_msg.destination, &address);
 
-      throw EndExecution{};
+      endExecution();
   }
 
   void EthereumInterface::eeiGetExternalCodeHash(uint32_t addressOffset, uint32_t resultOffset)
@@ -1073,11 +917,7 @@ namespace hera {
       takeInterfaceGas(GasSchedule::blockhash); // TODO
 
       evmc_address address = loadAddress(addressOffset);
-<<<<<<< HEAD
-      evmc_bytes32 codehash = m_host.get_code_hash(address);
-=======
       evmc_bytes32 codehash = m_context->host->get_code_hash(m_context, &address);
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
 
       // if (isZeroUint256(codehash))
       //   return 1;
@@ -1090,37 +930,21 @@ namespace hera {
       takeInterfaceGas(GasSchedule::base);
       return 666;
   }
-<<<<<<< HEAD
-
-=======
   
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
   void EthereumInterface::eeiGetSelfBalance(uint32_t resultOffset)
   {
       HERA_DEBUG << "getSelfBalance\n";
       takeInterfaceGas(GasSchedule::balance);
-<<<<<<< HEAD
-      evmc_uint256be balance = m_host.get_balance(m_msg.destination);
-      storeUint128(balance, resultOffset);
-  }
-
-=======
       evmc_uint256be balance = m_context->host->get_balance(m_context, &m_msg.destination);
       storeUint128(balance, resultOffset);
   }
   
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
   int64_t EthereumInterface::eeiGetBasefee()
   {
       HERA_DEBUG << "getBasefee\n";
       takeInterfaceGas(GasSchedule::base);
-<<<<<<< HEAD
-      return 0; 
-}
-=======
       return 0;
   }
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
 
   void EthereumInterface::takeGas(int64_t gas)
   {
@@ -1146,92 +970,71 @@ namespace hera {
     ensureCondition(memorySize() >= (offset + length), InvalidMemoryAccess, "Out of bounds (source) memory copy.");
   }
 
-  void EthereumInterface::loadMemoryReverse(uint32_t srcOffset, uint8_t *dst, size_t length)
+  uint8_t* EthereumInterface::sourceMemory(uint32_t offset, size_t length)
   {
-    // FIXME: the source bound check is not needed as the caller already ensures it
-    ensureCondition((srcOffset + length) >= srcOffset, InvalidMemoryAccess, "Out of bounds (source) memory copy.");
-    ensureCondition(memorySize() >= (srcOffset + length), InvalidMemoryAccess, "Out of bounds (source) memory copy.");
+    ensureCondition((offset + length) >= offset, InvalidMemoryAccess, "Out of bounds (source) memory copy.");
+    ensureCondition(memorySize() >= (offset + length), InvalidMemoryAccess, "Out of bounds (source) memory copy.");
 
     if (!length)
-      HERA_DEBUG << "Zero-length memory load from offset 0x" << hex << srcOffset << dec << "\n";
+      HERA_DEBUG << "Zero-length memory load from offset 0x" << hex << offset << dec << "\n";
 
-    // HERA_DEBUG << ":loadMemoryReverse::::::::" ;
-    // HERA_DEBUG << "length = " << length << ";;";
-    for (uint32_t i = 0; i < length; ++i) {
-      dst[length - (i + 1)] = memoryGet(srcOffset + i);
-        // HERA_DEBUG << hex << static_cast<int>(dst[length - (i + 1)]) << " ";
-    }
-    HERA_DEBUG << "\n";
+    return memoryData() + offset;
   }
 
-  void EthereumInterface::loadMemory(uint32_t srcOffset, uint8_t *dst, size_t length)
+  uint8_t* EthereumInterface::destinationMemory(uint32_t offset, size_t length)
   {
-    // FIXME: the source bound check is not needed as the caller already ensures it
-    ensureCondition((srcOffset + length) >= srcOffset, InvalidMemoryAccess, "Out of bounds (source) memory copy.");
-    ensureCondition(memorySize() >= (srcOffset + length), InvalidMemoryAccess, "Out of bounds (source) memory copy.");
+    ensureCondition((offset + length) >= offset, InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
+    ensureCondition(memorySize() >= (offset + length), InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
 
     if (!length)
-      HERA_DEBUG << "Zero-length memory load from offset 0x" << hex << srcOffset << dec << "\n";
+      HERA_DEBUG << "Zero-length memory store to offset 0x" << hex << offset << dec << "\n";
 
-    for (uint32_t i = 0; i < length; ++i) {
-      dst[i] = memoryGet(srcOffset + i);
-    }
+    return memoryData() + offset;
   }
 
-  void EthereumInterface::loadMemory(uint32_t srcOffset, vector<uint8_t> & dst, size_t length)
+  void EthereumInterface::loadMemoryReverse(uint32_t srcOffset, uint8_t *dst, size_t length)
   {
-    // FIXME: the source bound check is not needed as the caller already ensures it
-    ensureCondition((srcOffset + length) >= srcOffset, InvalidMemoryAccess, "Out of bounds (source) memory copy.");
-    ensureCondition(memorySize() >= (srcOffset + length), InvalidMemoryAccess, "Out of bounds (source) memory copy.");
-    ensureCondition(dst.size() >= length, InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
+    uint8_t const* src = sourceMemory(srcOffset, length);
+    reverseBytes(src, dst, length);
+  }
 
-    if (!length)
-      HERA_DEBUG << "Zero-length memory load from offset 0x" << hex << srcOffset << dec <<"\n";
+  void EthereumInterface::loadMemory(uint32_t srcOffset, uint8_t *dst, size_t length)
+  {
+    uint8_t const* src = sourceMemory(srcOffset, length);
+    if (length)
+      memcpy(dst, src, length);
+  }
 
-    for (uint32_t i = 0; i < length; ++i) {
-      dst[i] = memoryGet(srcOffset + i);
-    }
+  void EthereumInterface::loadMemory(uint32_t srcOffset, vector<uint8_t> & dst, size_t length)
+  {
+    ensureCondition(dst.size() >= length, InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
+    loadMemory(srcOffset, dst.data(), length);
   }
 
   void EthereumInterface::storeMemoryReverse(const uint8_t *src, uint32_t dstOffset, uint32_t length)
   {
-    ensureCondition((dstOffset + length) >= dstOffset, InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
-    ensureCondition(memorySize() >= (dstOffset + length), InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
-
-    if (!length)
-      HERA_DEBUG << "Zero-length memory store to offset 0x" << hex << dstOffset << dec << "\n";
-
-    for (uint32_t i = 0; i < length; ++i) {
-      memorySet(dstOffset + length - (i + 1), src[i]);
-    }
+    uint8_t* dst = destinationMemory(dstOffset, length);
+    reverseBytes(src, dst, length);
   }
 
   void EthereumInterface::storeMemory(const uint8_t *src, uint32_t dstOffset, uint32_t length)
   {
-    ensureCondition((dstOffset + length) >= dstOffset, InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
-    ensureCondition(memorySize() >= (dstOffset + length), InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
-
-    if (!length)
-      HERA_DEBUG << "Zero-length memory store to offset 0x" << hex << dstOffset << dec << "\n";
-
-    for (uint32_t i = 0; i < length; ++i) {
-      memorySet(dstOffset + i, src[i]);
-    }
+    uint8_t* dst = destinationMemory(dstOffset, length);
+    if (length)
+      memcpy(dst, src, length);
   }
 
-  void EthereumInterface::storeMemory(vector<uint8_t> const& src, uint32_t srcOffset, uint32_t dstOffset, uint32_t length)
+  void EthereumInterface::storeMemory(const uint8_t *src, size_t srcSize, uint32_t srcOffset, uint32_t dstOffset, uint32_t length)
   {
     ensureCondition((srcOffset + length) >= srcOffset, InvalidMemoryAccess, "Out of bounds (source) memory copy.");
-    ensureCondition(src.size() >= (srcOffset + length), InvalidMemoryAccess, "Out of bounds (source) memory copy.");
-    ensureCondition((dstOffset + length) >= dstOffset, InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
-    ensureCondition(memorySize() >= (dstOffset + length), InvalidMemoryAccess, "Out of bounds (destination) memory copy.");
+    ensureCondition(srcSize >= (size_t(srcOffset) + length), InvalidMemoryAccess, "Out of bounds (source) memory copy.");
 
-    if (!length)
-      HERA_DEBUG << "Zero-length memory store to offset 0x" << hex << dstOffset << dec << "\n";
+    storeMemory(src + srcOffset, dstOffset, length);
+  }
 
-    for (uint32_t i = 0; i < length; i++) {
-      memorySet(dstOffset + i, src[srcOffset + i]);
-    }
+  void EthereumInterface::storeMemory(vector<uint8_t> const& src, uint32_t srcOffset, uint32_t dstOffset, uint32_t length)
+  {
+    storeMemory(src.data(), src.size(), srcOffset, dstOffset, length);
   }
 
   /*
@@ -1298,6 +1101,41 @@ namespace hera {
   /*
    * Utilities
    */
+  void EthereumInterface::flushStorage()
+  {
+    Bytes32Equal equal;
+    for (auto const& path: m_pendingSlots) {
+      // A slot written again after its pending write was passed on is listed twice.
+      StorageSlot& slot = m_storage[path];
+      if (!equal(slot.value, slot.stored)) {
+        m_context->host->set_storage(m_context, &m_msg.destination, &path, &slot.value);
+        slot.stored = slot.value;
+      }
+    }
+    m_pendingSlots.clear();
+    m_storage.clear();
+  }
+
+  evmc_bytes32 EthereumInterface::loadStorage(evmc_bytes32 const& path)
+  {
+    auto it = m_storage.find(path);
+    if (it != m_storage.end())
+      return it->second.value;
+    evmc_bytes32 value = m_context->host->get_storage(m_context, &m_msg.destination, &path);
+    m_storage.emplace(path, StorageSlot{value, value});
+    return value;
+  }
+
+  size_t EthereumInterface::Bytes32Hash::operator()(evmc_bytes32 const& value) const
+  {
+    return static_cast<size_t>(hashBytes(value.bytes, sizeof(value.bytes)));
+  }
+
+  bool EthereumInterface::Bytes32Equal::operator()(evmc_bytes32 const& lhs, evmc_bytes32 const& rhs) const
+  {
+    return memcmp(lhs.bytes, rhs.bytes, sizeof(lhs.bytes)) == 0;
+  }
+
   void EthereumInterface::safeChargeDataCopy(uint32_t length, unsigned baseCost) {
     takeInterfaceGas(baseCost);
 
@@ -1321,38 +1159,21 @@ namespace hera {
   unsigned __int128 EthereumInterface::safeLoadUint128(evmc_uint256be const& value)
   {
     heraAssert(!exceedsUint128(value), "Account balance (or transaction value) exceeds 128 bits.");
-    unsigned __int128 ret = 0;
-    for (unsigned i = 16; i < 32; i++) {
-      ret <<= 8;
-      ret |= value.bytes[i];
-    }
-    return ret;
+    return loadBigEndian128(value.bytes + 16);
   }
 
   bool EthereumInterface::exceedsUint128(evmc_uint256be const& value)
   {
-    for (unsigned i = 0; i < 16; i++) {
-      if (value.bytes[i])
-        return true;
-    }
-    return false;
+    return !isZeroBytes(value.bytes, 16);
   }
 
   bool EthereumInterface::isZeroUint128(evmc_uint256be const& value)
   {
-    for (unsigned i = 16; i < 32; i++) {
-      if (value.bytes[i] != 0)
-        return false;
-    }
-    return true;
+    return isZeroBytes(value.bytes + 16, 16);
   }
 
   bool EthereumInterface::isZeroUint256(evmc_uint256be const& value)
   {
-    for (unsigned i = 0; i < 32; i++) {
-      if (value.bytes[i] != 0)
-        return false;
-    }
-    return true;
+    return isZeroBytes(value.bytes, 32);
   }
 }
@@ -16,11 +16,14 @@
 
 #pragma once
 
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include <evmc/evmc.h>
 
 #include "exceptions.h"
+#include "trace.h"
 
 namespace hera {
 
@@ -30,23 +33,58 @@ struct ExecutionResult {
   bool isRevert = false;
 };
 
-// There is a single engine instance in each VM instance and
-// likely execute() is called multiple times. As a result
-// an engine implementation cannot have instance variables with
-// side-effects.
-class WasmEngine {
+/// The engine specific form of a contract (e.g. a parsed and validated module),
+/// derived purely from its code. It is immutable once prepared, so it can be
+/// cached and shared between executions and threads.
+class PreparedModule {
 public:
-  virtual ~WasmEngine() noexcept = default;
+  virtual ~PreparedModule() noexcept = default;
+
+  /// Rough estimate of the memory used (in bytes), for the module cache budget.
+  virtual size_t memoryCost() const = 0;
+};
 
-  virtual ExecutionResult execute(
+/// A prepared module instantiated with its own memory and globals.
+/// An instance is owned by a single thread and executes a single message.
+class WasmInstance {
+public:
+  virtual ~WasmInstance() noexcept = default;
+
+  /// Executes the "main" function of the contract for @msg.
+  /// @state_code is the code residing in the state (used by interface methods such as codeCopy).
+  virtual ExecutionResult run(
     evmc_context* context,
-    std::vector<uint8_t> const& code,
     std::vector<uint8_t> const& state_code,
     evmc_message const& msg,
     bool meterInterfaceGas
   ) = 0;
+};
+
+// There is a single engine instance in each VM instance and it is
+// used for every execution. As a result an engine implementation
+// cannot have instance variables with side-effects. Anything derived
+// from the contract code belongs to the PreparedModule, which Hera
+// keeps across executions, and anything specific to an execution
+// belongs to the WasmInstance.
+class WasmEngine {
+public:
+  virtual ~WasmEngine() noexcept = default;
+
+  /// Parses and validates @code, including the checks of verifyContract().
+  /// @throws ContractValidationFailure if the code is not a valid contract.
+  virtual std::shared_ptr<PreparedModule const> prepare(std::vector<uint8_t> const& code) = 0;
+
+  /// Creates a fresh instance of a module returned by prepare() of the same engine.
+  /// The instance keeps the module alive.
+  virtual std::unique_ptr<WasmInstance> instantiate(std::shared_ptr<PreparedModule const> module) = 0;
 
   virtual void verifyContract(std::vector<uint8_t> const& code) = 0;
+
+  /// Makes the engine charge gas for the executed instructions itself, instead of
+  /// relying on useGas calls injected by the Sentinel. It applies to modules
+  /// prepared afterwards.
+  /// @returns false if the engine does not support it.
+  virtual bool setNativeMetering(bool enabled) { return !enabled; }
 };
 
 class EthereumInterface {
@@ -74,17 +112,30 @@ public:
 
     // cache the transaction context here
     m_tx_context = m_context->host->get_tx_context(m_context);
+
+    m_trace = traceEnabledFor(m_msg.destination);
   }
 
+  /// Passes the storage writes of the contract to the host. Engines call it when
+  /// the execution ended without an error, writes are dropped otherwise.
+  void flushStorage();
+
 // WAVM host functions access this interface through an instance,
 // which requires public methods.
 // TODO: update upstream WAVM to have a context (user data) passed down.
 #if HERA_WAVM == 0
 protected:
 #endif
-  virtual size_t memorySize() const = 0 ;
-  virtual void memorySet(size_t offset, uint8_t value) = 0;
-  virtual uint8_t memoryGet(size_t offset) = 0;
+  /// The linear memory of the instance, a contiguous block of memorySize() bytes.
+  virtual size_t memorySize() const = 0;
+  virtual uint8_t* memoryData() = 0;
+
+  /// Ends the execution after finish, revert and selfDestruct. The default throws
+  /// EndExecution. Engines which can stop the execution without unwinding
+  /// override it to return, and stop once the host function has returned. Only
+  /// WABT does: the interpreter of Binaryen 1.37.35 cannot be stopped by a host
+  /// call other than by throwing, and WAVM leaves compiled code by unwinding.
+  virtual void endExecution() { throw EndExecution{}; }
 
   enum class EEICallKind {
     Call,
@@ -137,26 +188,27 @@ protected:
   int64_t eeiGetBasefee();
   uint32_t eeiCreate2(uint32_t valueOffset, uint32_t dataOffset, uint32_t length, uint32_t saltOffset, uint32_t resultOffset);
 
-  void eeiGetExternalCodeHash(uint32_t addressOffset, uint32_t resultOffset);
-  int64_t eeiGetChainID();
-  void eeiGetSelfBalance(uint32_t resultOffset);
-  int64_t eeiGetBasefee();
-  uint32_t eeiCreate2(uint32_t valueOffset, uint32_t dataOffset, uint32_t length, uint32_t saltOffset, uint32_t resultOffset);
-
 private:
   void eeiRevertOrFinish(bool revert, uint32_t offset, uint32_t size);
 
+  /// Returns the value of @path in the storage of the account, as seen by the contract.
+  evmc_bytes32 loadStorage(evmc_bytes32 const& path);
+
   // Helpers methods
 
   void takeGas(int64_t gas);
   void takeInterfaceGas(int64_t gas);
 
   void ensureSourceMemoryBounds(uint32_t offset, uint32_t length);
+  /// Return a pointer to @length bytes of memory at @offset after checking the bounds.
+  uint8_t* sourceMemory(uint32_t offset, size_t length);
+  uint8_t* destinationMemory(uint32_t offset, size_t length);
   void loadMemoryReverse(uint32_t srcOffset, uint8_t *dst, size_t length);
   void loadMemory(uint32_t srcOffset, uint8_t *dst, size_t length);
   void loadMemory(uint32_t srcOffset, std::vector<uint8_t> & dst, size_t length);
   void storeMemoryReverse(const uint8_t *src, uint32_t dstOffset, uint32_t length);
   void storeMemory(const uint8_t *src, uint32_t dstOffset, uint32_t length);
+  void storeMemory(const uint8_t *src, size_t srcSize, uint32_t srcOffset, uint32_t dstOffset, uint32_t length);
   void storeMemory(std::vector<uint8_t> const& src, uint32_t srcOffset, uint32_t dstOffset, uint32_t length);
 
   evmc_uint256be loadBytes32(uint32_t srcOffset);
@@ -186,6 +238,21 @@ private:
   /* Checks if a 256 bit value is all zeroes */
   static bool isZeroUint256(evmc_uint256be const& value);
 
+  // A slot of the storage of the account, read from or written by the contract.
+  struct StorageSlot {
+    evmc_bytes32 value;
+    // The value of the host, which differs from @value while a write is pending.
+    evmc_bytes32 stored;
+  };
+
+  struct Bytes32Hash {
+    size_t operator()(evmc_bytes32 const& value) const;
+  };
+
+  struct Bytes32Equal {
+    bool operator()(evmc_bytes32 const& lhs, evmc_bytes32 const& rhs) const;
+  };
+
   evmc_tx_context m_tx_context{};
   evmc_context* m_context = nullptr;
   std::vector<uint8_t> const& m_code;
@@ -193,6 +260,13 @@ private:
   std::vector<uint8_t> m_lastReturnData;
   ExecutionResult & m_result;
   bool m_meterGas = true;
+  bool m_trace = false;
+  // Storage accessed during this execution. It is flushed and emptied before the
+  // host runs other code, which may access the storage of the account too.
+  std::unordered_map<evmc_bytes32, StorageSlot, Bytes32Hash, Bytes32Equal> m_storage;
+  // Slots of m_storage with a pending write, in the order they were written, so
+  // that the host sees the writes in the same order on every run.
+  std::vector<evmc_bytes32> m_pendingSlots;
 };
 
 struct GasSchedule {
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <cstring>
 #include <vector>
 #include <iomanip>
 #include <sstream>
@@ -104,4 +105,28 @@ bool hasWasmVersion(vector<uint8_t> const& _input, uint8_t _version) {
     _input[7] == 0;
 }
 
+uint64_t hashBytes(const uint8_t *bytes, size_t length, uint64_t seed) {
+  // Process the input in 64-bit words and finalise with the MurmurHash3 mixer.
+  const uint64_t k = 0x87c37b91114253d5ULL;
+  uint64_t h = seed ^ (length * 0x9e3779b97f4a7c15ULL);
+  size_t i = 0;
+  for (; i + 8 <= length; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, 8);
+    h ^= word * k;
+    h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+  }
+  uint64_t tail = 0;
+  for (size_t shift = 0; i < length; ++i, shift += 8)
+    tail |= uint64_t(bytes[i]) << shift;
+  h ^= tail * k;
+
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
 }
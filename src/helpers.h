@@ -35,4 +35,8 @@ bool hasWasmPreamble(std::vector<uint8_t> const& _input);
 
 bool hasWasmVersion(std::vector<uint8_t> const& _input, uint8_t _version);
 
+// Returns a fast, non-cryptographic 64-bit hash of the bytes. Suitable for hash tables,
+// but not for anything where an adversary may benefit from a collision.
+uint64_t hashBytes(const uint8_t *bytes, size_t length, uint64_t seed = 0);
+
 }
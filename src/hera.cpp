@@ -16,8 +16,14 @@
 
 #include <hera/hera.h>
 
+#include <atomic>
+#include <chrono>
 #include <limits>
+#include <cerrno>
+#include <cctype>
+#include <cstdlib>
 #include <cstring>
+#include <mutex>
 #include <vector>
 #include <unistd.h>
 #include <iostream>
@@ -29,12 +35,19 @@
 #include <evm2wasm.h>
 
 #include "binaryen.h"
+#include "cache.h"
 #include "debugging.h"
 #include "eei.h"
 #include "exceptions.h"
 #include "helpers.h"
+#include "idle-budget.h"
+#include "metering.h"
+#include "trace.h"
+#include "translator.h"
 #if HERA_WAVM
+#include "tiered.h"
 #include "wavm.h"
+#include "wavm-object-cache.h"
 #endif
 #if HERA_WABT
 #include "wabt.h"
@@ -63,7 +76,16 @@ enum class hera_evm1mode {
   evm2wasm_cpp,
   evm2wasm_cpp_tracing,
   evm2wasm_js,
-  evm2wasm_js_tracing
+  evm2wasm_js_tracing,
+  evm2wasm_js_worker,
+  evm2wasm_js_worker_tracing
+};
+
+// The in-process Sentinel (injectMetering()) is only compared to the contract
+// until it is shown to produce the same output, see scripts/sentinel-tests.sh.
+enum class hera_sentinel {
+  contract,
+  verify
 };
 
 using WasmEngineCreateFn = unique_ptr<WasmEngine>(*)();
@@ -72,6 +94,7 @@ const map<string, WasmEngineCreateFn> wasm_engine_map {
   { "binaryen", BinaryenEngine::create },
 #if HERA_WAVM
   { "wavm", WavmEngine::create },
+  { "tiered", TieredEngine::create },
 #endif
 #if HERA_WABT
   { "wabt", WabtEngine::create },
@@ -86,13 +109,49 @@ const map<string, hera_evm1mode> evm1mode_options {
   { "evm2wasm.cpp-trace", hera_evm1mode::evm2wasm_cpp_tracing },
   { "evm2wasm.js", hera_evm1mode::evm2wasm_js },
   { "evm2wasm.js-trace", hera_evm1mode::evm2wasm_js_tracing },
+  { "evm2wasm.js-worker", hera_evm1mode::evm2wasm_js_worker },
+  { "evm2wasm.js-worker-trace", hera_evm1mode::evm2wasm_js_worker_tracing },
 };
 
+const map<string, hera_sentinel> sentinel_options {
+  { "contract", hera_sentinel::contract },
+  { "verify", hera_sentinel::verify },
+};
+
+// WebAssembly code translated from EVM1 bytecode.
+struct TranslatedCode {
+  vector<uint8_t> code;
+  // The time it took to translate, used to report the time saved by the cache.
+  chrono::nanoseconds translationTime;
+};
+
+// hera_execute() may be called concurrently on the same instance. The options
+// are only changed by hera_set_option(), which must not run concurrently with
+// executions, and the caches and the translator process are synchronized.
 struct hera_instance : evmc_instance {
   unique_ptr<WasmEngine> engine{new BinaryenEngine};
   hera_evm1mode evm1mode = hera_evm1mode::reject;
+  // Metering with the Sentinel at deployment.
   bool metering = false;
+  // How the Sentinel is run.
+  hera_sentinel sentinel = hera_sentinel::contract;
+  // Metering by the engine while executing, see WasmEngine::setNativeMetering().
+  bool native_metering = false;
   map<evmc_address, vector<uint8_t>> contract_preload_list;
+  // Modules prepared by the engine, keyed by their code.
+  CodeCache<PreparedModule const> module_cache{64 * 1024 * 1024};
+  CodeCache<TranslatedCode> translation_cache{16 * 1024 * 1024};
+  // Metered code, keyed by the code before metering.
+  CodeCache<vector<uint8_t> const> metering_cache{16 * 1024 * 1024};
+  atomic<chrono::nanoseconds::rep> translation_time_saved{0};
+  // Deployments metered with sentinel=verify, and those where injectMetering() differed.
+  atomic<uint64_t> sentinel_verified{0};
+  atomic<uint64_t> sentinel_differences{0};
+  string evm2wasm_worker_command = "evm2wasm-worker.js";
+  chrono::milliseconds evm2wasm_worker_timeout{10000};
+  // Guards evm2wasm_worker, which handles a single request at a time.
+  mutex evm2wasm_worker_mutex;
+  unique_ptr<TranslatorProcess> evm2wasm_worker;
 
   hera_instance() noexcept : evmc_instance({EVMC_ABI_VERSION, "hera", hera_get_buildinfo()->project_version, nullptr, nullptr, nullptr, nullptr, nullptr}) {}
 };
@@ -138,7 +197,7 @@ pair<evmc_status_code, vector<uint8_t>> callSystemContract(
 
 // Calls the Sentinel contract with input data @input.
 // @returns the validated and metered output or empty output otherwise.
-vector<uint8_t> sentinel(evmc_context* context, vector<uint8_t> const& input)
+vector<uint8_t> sentinelContract(evmc_context* context, vector<uint8_t> const& input)
 {
   HERA_DEBUG << "Metering (input " << input.size() << " bytes)...\n";
 
@@ -165,6 +224,68 @@ vector<uint8_t> sentinel(evmc_context* context, vector<uint8_t> const& input)
   return ret;
 }
 
+// Meters @input with the Sentinel contract and compares the output to the one
+// of injectMetering(). The contract stays authoritative, differences are counted
+// and reported in the debug output, so that they can be collected from a run
+// over a corpus.
+// @returns the validated and metered output of the contract.
+vector<uint8_t> sentinelVerify(hera_instance* hera, evmc_context* context, vector<uint8_t> const& input)
+{
+  vector<uint8_t> native;
+  string nativeError;
+  try {
+    native = injectMetering(input);
+  } catch (ContractValidationFailure const& e) {
+    nativeError = e.what();
+  }
+
+  hera->sentinel_verified.fetch_add(1, memory_order_relaxed);
+  vector<uint8_t> reference;
+  try {
+    reference = sentinelContract(context, input);
+  } catch (ContractValidationFailure const&) {
+    if (nativeError.empty()) {
+      hera->sentinel_differences.fetch_add(1, memory_order_relaxed);
+      HERA_DEBUG << "Native metering accepted a contract rejected by the Sentinel\n";
+    }
+    throw;
+  }
+
+  if (!nativeError.empty()) {
+    hera->sentinel_differences.fetch_add(1, memory_order_relaxed);
+    HERA_DEBUG << "Native metering rejected a contract accepted by the Sentinel: " << nativeError << "\n";
+  } else if (native != reference) {
+    hera->sentinel_differences.fetch_add(1, memory_order_relaxed);
+    HERA_DEBUG << "Native metering differs from the Sentinel (" << native.size() << " and " << reference.size() << " bytes)\n";
+  }
+  return reference;
+}
+
+// Meters @input with the Sentinel selected for @hera.
+// The result is cached, as factories deploy the same code over and over again.
+// Outputs of the contract are tagged with its code hash, so that a change of the
+// Sentinel in the state does not return stale results.
+// @returns the validated and metered output.
+vector<uint8_t> meter(hera_instance* hera, evmc_context* context, vector<uint8_t> const& input)
+{
+  // The comparison is the purpose of verification, it is always done.
+  if (hera->sentinel == hera_sentinel::verify)
+    return sentinelVerify(hera, context, input);
+
+  evmc_bytes32 codeHash = context->host->get_code_hash(context, &sentinelAddress);
+  uint64_t tag = hashBytes(codeHash.bytes, sizeof(codeHash.bytes), 1);
+
+  shared_ptr<vector<uint8_t> const> cached = hera->metering_cache.find(input, tag);
+  if (cached) {
+    HERA_DEBUG << "Using cached metering (input " << input.size() << " bytes)\n";
+    return *cached;
+  }
+
+  auto ret = make_shared<vector<uint8_t> const>(sentinelContract(context, input));
+  hera->metering_cache.insert(input, ret, ret->size(), tag);
+  return *ret;
+}
+
 // NOTE: assumes that pattern doesn't contain any formatting characters (e.g. %)
 string mktemp_string(string pattern) {
   const unsigned long len = pattern.size();
@@ -253,6 +374,83 @@ vector<uint8_t> evm2wasm(evmc_context* context, vector<uint8_t> const& input) {
   return ret;
 }
 
+// Translates EVM1 bytecode @input to WebAssembly using the translator selected by evm1mode.
+// The result is cached, as the same contracts are called over and over again.
+// @returns the compiled output.
+vector<uint8_t> translateEvm1(hera_instance* hera, evmc_context* context, vector<uint8_t> const& input)
+{
+  bool evmTrace =
+    hera->evm1mode == hera_evm1mode::evm2wasm_cpp_tracing ||
+    hera->evm1mode == hera_evm1mode::evm2wasm_js_tracing ||
+    hera->evm1mode == hera_evm1mode::evm2wasm_js_worker_tracing;
+
+  uint64_t tag = evmTrace;
+  // Outputs of the contract are tagged with its code hash, so that a change of the
+  // translator in the state does not return stale results.
+  if (hera->evm1mode == hera_evm1mode::evm2wasm_contract) {
+    evmc_bytes32 codeHash = context->host->get_code_hash(context, &evm2wasmAddress);
+    tag = hashBytes(codeHash.bytes, sizeof(codeHash.bytes), 2);
+  }
+
+  shared_ptr<TranslatedCode> cached = hera->translation_cache.find(input, tag);
+  if (cached) {
+    HERA_DEBUG << "Using cached translation (input " << input.size() << " bytes)\n";
+    hera->translation_time_saved.fetch_add(cached->translationTime.count(), memory_order_relaxed);
+    return cached->code;
+  }
+
+  auto start = chrono::steady_clock::now();
+
+  vector<uint8_t> ret;
+  switch (hera->evm1mode) {
+  case hera_evm1mode::evm2wasm_contract:
+    ret = evm2wasm(context, input);
+    ensureCondition(ret.size() > 8, ContractValidationFailure, "Transcompiling via evm2wasm failed");
+    break;
+  case hera_evm1mode::evm2wasm_cpp:
+  case hera_evm1mode::evm2wasm_cpp_tracing:
+    ret = evm2wasm_cpp(input, evmTrace);
+    ensureCondition(ret.size() > 8, ContractValidationFailure, "Transcompiling via evm2wasm.cpp failed");
+    break;
+  case hera_evm1mode::evm2wasm_js:
+  case hera_evm1mode::evm2wasm_js_tracing:
+    ret = evm2wasm_js(input, evmTrace);
+    ensureCondition(ret.size() > 8, ContractValidationFailure, "Transcompiling via evm2wasm.js failed");
+    break;
+  case hera_evm1mode::evm2wasm_js_worker:
+  case hera_evm1mode::evm2wasm_js_worker_tracing: {
+    lock_guard<mutex> lock(hera->evm2wasm_worker_mutex);
+    if (!hera->evm2wasm_worker)
+      hera->evm2wasm_worker.reset(new TranslatorProcess(hera->evm2wasm_worker_command, hera->evm2wasm_worker_timeout));
+    ret = hera->evm2wasm_worker->translate(input, evmTrace);
+    ensureCondition(ret.size() > 8, ContractValidationFailure, "Transcompiling via evm2wasm.js worker failed");
+    break;
+  }
+  default:
+    heraAssert(false, "evm1mode does not translate.");
+  }
+
+  auto translationTime = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+  hera->translation_cache.insert(input, make_shared<TranslatedCode>(TranslatedCode{ret, translationTime}), ret.size(), tag);
+
+  return ret;
+}
+
+// Parses and validates @code with the selected engine.
+// The result is cached, so that a contract is only prepared once.
+shared_ptr<PreparedModule const> prepareModule(hera_instance* hera, vector<uint8_t> const& code)
+{
+  shared_ptr<PreparedModule const> module = hera->module_cache.find(code);
+  if (module) {
+    HERA_DEBUG << "Module cache hit (" << code.size() << " bytes)\n";
+    return module;
+  }
+
+  module = hera->engine->prepare(code);
+  hera->module_cache.insert(code, module, module->memoryCost());
+  return module;
+}
+
 void hera_destroy_result(evmc_result const* result) noexcept
 {
   delete[] result->output_data;
@@ -274,13 +472,9 @@ evmc_result hera_execute(
   memset(&ret, 0, sizeof(evmc_result));
 
   try {
-<<<<<<< HEAD
-    heraAssert(true || rev == EVMC_BYZANTIUM, "Only Byzantium supported.");
-=======
+    TraceTransaction traceTransaction(*msg);
 
-    HERA_DEBUG << "-----------------------------------EVMC Version:: " << EVMC_BYZANTIUM << "-------------------------------n";
-    heraAssert( true || rev == EVMC_BYZANTIUM, "Only Byzantium supported.");
->>>>>>> 4f169bc7616c7fb74d4f153c037eb2b7eaac6157
+    heraAssert(true || rev == EVMC_BYZANTIUM, "Only Byzantium supported.");
     heraAssert(msg->gas >= 0, "EVMC supplied negative startgas");
 
     bool meterInterfaceGas = true;
@@ -304,22 +498,13 @@ evmc_result hera_execute(
     if (!isWasm) {
       switch (hera->evm1mode) {
       case hera_evm1mode::evm2wasm_contract:
-        run_code = evm2wasm(context, run_code);
-        ensureCondition(run_code.size() > 8, ContractValidationFailure, "Transcompiling via evm2wasm failed");
-        // TODO: enable this once evm2wasm does metering of interfaces
-        // meterInterfaceGas = false;
-        break;
       case hera_evm1mode::evm2wasm_cpp:
       case hera_evm1mode::evm2wasm_cpp_tracing:
-        run_code = evm2wasm_cpp(run_code, hera->evm1mode == hera_evm1mode::evm2wasm_cpp_tracing);
-        ensureCondition(run_code.size() > 8, ContractValidationFailure, "Transcompiling via evm2wasm.cpp failed");
-        // TODO: enable this once evm2wasm does metering of interfaces
-        // meterInterfaceGas = false;
-        break;
       case hera_evm1mode::evm2wasm_js:
       case hera_evm1mode::evm2wasm_js_tracing:
-        run_code = evm2wasm_js(run_code, hera->evm1mode == hera_evm1mode::evm2wasm_js_tracing);
-        ensureCondition(run_code.size() > 8, ContractValidationFailure, "Transcompiling via evm2wasm.js failed");
+      case hera_evm1mode::evm2wasm_js_worker:
+      case hera_evm1mode::evm2wasm_js_worker_tracing:
+        run_code = translateEvm1(hera, context, run_code);
         // TODO: enable this once evm2wasm does metering of interfaces
         // meterInterfaceGas = false;
         break;
@@ -344,7 +529,7 @@ evmc_result hera_execute(
     if (msg->kind == EVMC_CREATE && isWasm) {
       // Meter the deployment (constructor) code if it is WebAssembly
       if (hera->metering)
-        run_code = sentinel(context, run_code);
+        run_code = meter(hera, context, run_code);
       ensureCondition(
         hasWasmPreamble(run_code) && hasWasmVersion(run_code, 1),
         ContractValidationFailure,
@@ -355,7 +540,9 @@ evmc_result hera_execute(
     heraAssert(hera->engine, "Wasm engine not set.");
     WasmEngine& engine = *hera->engine;
 
-    ExecutionResult result = engine.execute(context, run_code, state_code, *msg, meterInterfaceGas);
+    shared_ptr<PreparedModule const> module = prepareModule(hera, run_code);
+    unique_ptr<WasmInstance> instance = engine.instantiate(move(module));
+    ExecutionResult result = instance->run(context, state_code, *msg, meterInterfaceGas);
     heraAssert(result.gasLeft >= 0, "Negative gas left after execution.");
 
     // copy call result
@@ -370,14 +557,16 @@ evmc_result hera_execute(
         );
 
         // Meter the deployed code if it is WebAssembly
-        returnValue = hera->metering ? sentinel(context, result.returnValue) : move(result.returnValue);
+        returnValue = hera->metering ? meter(hera, context, result.returnValue) : move(result.returnValue);
         ensureCondition(
           hasWasmPreamble(returnValue) && hasWasmVersion(returnValue, 1),
           ContractValidationFailure,
           "Invalid contract or metering failed."
         );
         // FIXME: this should be done by the sentinel
-        engine.verifyContract(returnValue);
+        // Preparing the module verifies it, and it is cached under the code stored
+        // by the host, so that the first call does not parse it again.
+        prepareModule(hera, returnValue);
       } else {
         returnValue = move(result.returnValue);
       }
@@ -428,6 +617,43 @@ evmc_result hera_execute(
   return ret;
 }
 
+// Parses a non-negative decimal number.
+bool parseSize(char const* value, size_t & output)
+{
+  if (!value || !isdigit(static_cast<unsigned char>(value[0])))
+    return false;
+  char* end = nullptr;
+  errno = 0;
+  unsigned long long ret = strtoull(value, &end, 10);
+  if (errno != 0 || *end != 0 || ret > numeric_limits<size_t>::max())
+    return false;
+  output = static_cast<size_t>(ret);
+  return true;
+}
+
+bool parseAddressList(char const* value, vector<evmc_address> & output)
+{
+  output.clear();
+  string list(value);
+  size_t start = 0;
+  while (start < list.size()) {
+    size_t end = list.find(',', start);
+    if (end == string::npos)
+      end = list.size();
+    string item = list.substr(start, end - start);
+    if (item.find("0x") == 0)
+      item = item.substr(2);
+    vector<uint8_t> bytes = parseHexString(item);
+    if (bytes.size() != 20)
+      return false;
+    evmc_address address{};
+    copy(bytes.begin(), bytes.end(), address.bytes);
+    output.push_back(address);
+    start = end + 1;
+  }
+  return true;
+}
+
 bool hera_parse_sys_option(hera_instance *hera, string const& _name, string const& value)
 {
   heraAssert(_name.find("sys:") == 0, "");
@@ -472,6 +698,13 @@ bool hera_parse_sys_option(hera_instance *hera, string const& _name, string cons
 
   hera->contract_preload_list[address] = vector<uint8_t>(contents.begin(), contents.end());
 
+  // Previous translations were done by a different translator.
+  if (address == evm2wasmAddress)
+    hera->translation_cache.clear();
+  // Previous metering was done by a different Sentinel.
+  if (address == sentinelAddress)
+    hera->metering_cache.clear();
+
   return true;
 }
 
@@ -491,14 +724,148 @@ evmc_set_option_result hera_set_option(
   }
 
   if (strcmp(name, "metering") == 0) {
+    bool native = strcmp(value, "native") == 0;
+    if (!hera->engine->setNativeMetering(native))
+      return EVMC_SET_OPTION_INVALID_VALUE;
     hera->metering = strcmp(value, "true") == 0;
+    hera->native_metering = native;
+    // Prepared modules are metered or not.
+    hera->module_cache.clear();
     return EVMC_SET_OPTION_SUCCESS;
   }
 
+  if (strcmp(name, "sentinel") == 0) {
+    if (sentinel_options.count(value)) {
+      hera->sentinel = sentinel_options.at(value);
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
   if (strcmp(name, "engine") == 0) {
     auto it = wasm_engine_map.find(value);
     if (it != wasm_engine_map.end()) {
-      hera->engine = it->second();
+      unique_ptr<WasmEngine> engine = it->second();
+      if (!engine->setNativeMetering(hera->native_metering))
+        return EVMC_SET_OPTION_INVALID_VALUE;
+      hera->engine = move(engine);
+      // Prepared modules belong to the engine which prepared them.
+      hera->module_cache.clear();
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "evm2wasm.js-worker") == 0) {
+    if (strlen(value) == 0)
+      return EVMC_SET_OPTION_INVALID_VALUE;
+    hera->evm2wasm_worker_command = value;
+    hera->evm2wasm_worker.reset();
+    hera->translation_cache.clear();
+    return EVMC_SET_OPTION_SUCCESS;
+  }
+
+  if (strcmp(name, "evm2wasm.js-worker-timeout") == 0) {
+    size_t timeout;
+    if (parseSize(value, timeout) && timeout > 0) {
+      hera->evm2wasm_worker_timeout = chrono::milliseconds(timeout);
+      hera->evm2wasm_worker.reset();
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "translation-cache-size") == 0) {
+    size_t size;
+    if (parseSize(value, size)) {
+      hera->translation_cache.setCapacity(size);
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "metering-cache-size") == 0) {
+    size_t size;
+    if (parseSize(value, size)) {
+      hera->metering_cache.setCapacity(size);
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "module-cache-size") == 0) {
+    size_t size;
+    if (parseSize(value, size)) {
+      hera->module_cache.setCapacity(size);
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "idle-cache-size") == 0) {
+    size_t size;
+    if (parseSize(value, size)) {
+      setIdleStateBudget(size);
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+#if HERA_WAVM
+  if (strcmp(name, "wavm-cache-dir") == 0) {
+#if !HERA_WAVM_OBJECT_CACHE
+    // The pinned WAVM builds instance specific values into the object code, so
+    // cached code is never found again after a restart. See wavm-object-cache.h.
+    if (strlen(value) > 0) {
+      HERA_DEBUG << "wavm-cache-dir is not available in this build\n";
+      return EVMC_SET_OPTION_INVALID_VALUE;
+    }
+#endif
+    if (wavmObjectCacheOpen(value))
+      return EVMC_SET_OPTION_SUCCESS;
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "wavm-cache-size") == 0) {
+    size_t size;
+    if (parseSize(value, size)) {
+      wavmObjectCacheSetSize(size);
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+#endif
+
+  if (strcmp(name, "trace") == 0) {
+    if (traceOpen(value))
+      return EVMC_SET_OPTION_SUCCESS;
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "trace-format") == 0) {
+    bool set;
+    if (strcmp(value, "text") == 0)
+      set = traceSetFormat(TraceFormat::Text);
+    else if (strcmp(value, "binary") == 0)
+      set = traceSetFormat(TraceFormat::Binary);
+    else
+      return EVMC_SET_OPTION_INVALID_VALUE;
+    return set ? EVMC_SET_OPTION_SUCCESS : EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "trace-address") == 0) {
+    vector<evmc_address> addresses;
+    if (parseAddressList(value, addresses)) {
+      traceSetAddressFilter(move(addresses));
+      return EVMC_SET_OPTION_SUCCESS;
+    }
+    return EVMC_SET_OPTION_INVALID_VALUE;
+  }
+
+  if (strcmp(name, "trace-sample") == 0) {
+    size_t rate;
+    if (parseSize(value, rate) && rate > 0) {
+      traceSetSampleRate(rate);
       return EVMC_SET_OPTION_SUCCESS;
     }
     return EVMC_SET_OPTION_INVALID_VALUE;
@@ -516,6 +883,28 @@ evmc_set_option_result hera_set_option(
 void hera_destroy(evmc_instance* instance) noexcept
 {
   hera_instance* hera = static_cast<hera_instance*>(instance);
+
+  CacheStats stats = hera->module_cache.stats();
+  HERA_DEBUG << "Module cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+    << stats.evictions << " evictions, " << stats.entries << " entries ("
+    << stats.size << " of " << stats.capacity << " bytes)\n";
+
+  stats = hera->translation_cache.stats();
+  HERA_DEBUG << "Translation cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+    << stats.evictions << " evictions, " << stats.entries << " entries ("
+    << stats.size << " of " << stats.capacity << " bytes), "
+    << chrono::duration_cast<chrono::milliseconds>(chrono::nanoseconds(hera->translation_time_saved.load())).count() << " ms translation time saved\n";
+
+  stats = hera->metering_cache.stats();
+  HERA_DEBUG << "Metering cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+    << stats.evictions << " evictions, " << stats.entries << " entries ("
+    << stats.size << " of " << stats.capacity << " bytes)\n";
+
+  HERA_DEBUG << "Sentinel verification: " << hera->sentinel_verified.load() << " deployments compared, "
+    << hera->sentinel_differences.load() << " differences\n";
+
+  HERA_DEBUG << "Trace: " << traceDroppedRecords() << " records dropped\n";
+
   delete hera;
 }
 
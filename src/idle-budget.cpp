@@ -0,0 +1,53 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+
+#include "idle-budget.h"
+
+using namespace std;
+
+namespace hera {
+
+namespace {
+
+atomic<size_t> idleStateBudget{64 * 1024 * 1024};
+atomic<size_t> idleStateUsed{0};
+
+}
+
+bool reserveIdleState(size_t bytes)
+{
+  size_t budget = idleStateBudget.load();
+  size_t used = idleStateUsed.load();
+  do {
+    if (used > budget || bytes > budget - used)
+      return false;
+  } while (!idleStateUsed.compare_exchange_weak(used, used + bytes));
+  return true;
+}
+
+void releaseIdleState(size_t bytes)
+{
+  idleStateUsed -= bytes;
+}
+
+void setIdleStateBudget(size_t bytes)
+{
+  idleStateBudget = bytes;
+}
+
+}
@@ -0,0 +1,36 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace hera {
+
+/// Engines keep the state of finished instances (e.g. memories and compiled
+/// code) with their module for reuse. The idle state of all modules shares
+/// one budget per process, as it is not part of PreparedModule::memoryCost().
+/// @returns false if @bytes do not fit, they are not reserved then.
+bool reserveIdleState(size_t bytes);
+
+/// Returns @bytes reserved by reserveIdleState() to the budget.
+void releaseIdleState(size_t bytes);
+
+/// Sets the budget of reserveIdleState() (64 MiB by default). State reserved
+/// beyond a lowered budget is kept until it is released.
+void setIdleStateBudget(size_t bytes);
+
+}
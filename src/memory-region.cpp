@@ -0,0 +1,216 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "exceptions.h"
+#include "memory-region.h"
+
+using namespace std;
+
+namespace hera {
+
+namespace {
+
+// Idle regions kept for each thread, more are unmapped.
+constexpr size_t maxIdleRegions = 4;
+
+// Dirty ranges up to this size are cleared in place, larger ones are dropped
+// and zeroed by the kernel when touched again.
+constexpr size_t clearInPlaceLimit = 256 * 1024;
+
+struct RegionPool {
+  vector<MemoryRegion> idle;
+
+  ~RegionPool()
+  {
+    for (auto const& region: idle)
+      munmap(region.base, memoryRegionSize);
+  }
+};
+
+thread_local RegionPool pool;
+
+// Granularity at which zero ranges are left out of a MemoryImage.
+constexpr size_t imagePageSize = 4096;
+
+// Calls @f(offset, length) for each maximal run of pages of @data which are not all zero.
+template <typename F>
+void forEachNonZeroRange(char const* data, size_t size, F f)
+{
+  size_t begin = 0;
+  bool inRange = false;
+  for (size_t offset = 0; offset < size; offset += imagePageSize) {
+    size_t length = min(imagePageSize, size - offset);
+    bool zero = data[offset] == 0 && memcmp(data + offset, data + offset + 1, length - 1) == 0;
+    if (!zero && !inRange) {
+      begin = offset;
+      inRange = true;
+    } else if (zero && inRange) {
+      f(begin, offset - begin);
+      inRange = false;
+    }
+  }
+  if (inRange)
+    f(begin, size - begin);
+}
+
+// Maps fresh zeroed pages over the range, also replacing a mapped image.
+bool mapAnonymous(char* begin, size_t length)
+{
+  void* mapped = mmap(begin, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+  return mapped != MAP_FAILED;
+}
+
+// Zeroes the pages and releases their physical memory.
+void dropPages(char* begin, size_t length)
+{
+#if defined(__linux__)
+  madvise(begin, length, MADV_DONTNEED);
+#else
+  // Elsewhere MADV_DONTNEED does not guarantee zeroes, fresh pages are mapped over the range.
+  if (!mapAnonymous(begin, length))
+    memset(begin, 0, length);
+#endif
+}
+
+}
+
+MemoryRegion acquireMemoryRegion()
+{
+  if (!pool.idle.empty()) {
+    MemoryRegion region = pool.idle.back();
+    pool.idle.pop_back();
+    return region;
+  }
+
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  void* reserved = mmap(nullptr, memoryRegionSize, PROT_NONE, flags, -1, 0);
+  if (reserved == MAP_FAILED)
+    throw bad_alloc();
+
+  MemoryRegion region;
+  region.base = static_cast<char*>(reserved);
+  return region;
+}
+
+void releaseMemoryRegion(MemoryRegion region, size_t dirty)
+{
+  if (!region.base)
+    return;
+
+  if (pool.idle.size() >= maxIdleRegions) {
+    munmap(region.base, memoryRegionSize);
+    return;
+  }
+
+  // The pages stay accessible, so the next execution needs no mprotect() for them.
+  if (region.imageMapped) {
+    // Dropping the pages of an image would restore the image, not zeroes.
+    if (!mapAnonymous(region.base, region.committed)) {
+      munmap(region.base, memoryRegionSize);
+      return;
+    }
+    region.imageMapped = 0;
+    pool.idle.push_back(region);
+    return;
+  }
+
+  dirty = min(dirty, region.committed);
+  if (dirty <= clearInPlaceLimit)
+    memset(region.base, 0, dirty);
+  else
+    dropPages(region.base, region.committed);
+
+  pool.idle.push_back(region);
+}
+
+MemoryImage::MemoryImage(char const* data, size_t size):
+  m_size(size)
+{
+  forEachNonZeroRange(data, size, [&](size_t, size_t length) {
+    m_stored += length;
+  });
+
+#if defined(MFD_CLOEXEC)
+  if (size > 0) {
+    // The file is sparse, the ranges left out read as zero.
+    m_fd = memfd_create("hera-memory-image", MFD_CLOEXEC);
+    bool complete = m_fd >= 0 && ftruncate(m_fd, static_cast<off_t>(size)) == 0;
+    if (complete)
+      forEachNonZeroRange(data, size, [&](size_t offset, size_t length) {
+        size_t written = 0;
+        while (complete && written < length) {
+          ssize_t ret = pwrite(m_fd, data + offset + written, length - written, static_cast<off_t>(offset + written));
+          if (ret <= 0)
+            complete = false;
+          else
+            written += static_cast<size_t>(ret);
+        }
+      });
+    if (complete)
+      return;
+    if (m_fd >= 0)
+      close(m_fd);
+    m_fd = -1;
+  }
+#endif
+  forEachNonZeroRange(data, size, [&](size_t offset, size_t length) {
+    m_chunks.push_back(Chunk{offset, vector<char>(data + offset, data + offset + length)});
+  });
+}
+
+MemoryImage::~MemoryImage()
+{
+  if (m_fd >= 0)
+    close(m_fd);
+}
+
+void MemoryImage::apply(MemoryRegion& region) const
+{
+  if (m_fd >= 0) {
+    void* mapped = mmap(region.base, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, m_fd, 0);
+    if (mapped != MAP_FAILED) {
+      region.imageMapped = max(region.imageMapped, m_size);
+      return;
+    }
+    size_t read = 0;
+    while (read < m_size) {
+      ssize_t ret = pread(m_fd, region.base + read, m_size - read, static_cast<off_t>(read));
+      heraAssert(ret > 0, "Failed to read the memory image.");
+      read += static_cast<size_t>(ret);
+    }
+    return;
+  }
+  size_t end = 0;
+  for (auto const& chunk: m_chunks) {
+    memset(region.base + end, 0, chunk.offset - end);
+    copy(chunk.data.begin(), chunk.data.end(), region.base + chunk.offset);
+    end = chunk.offset + chunk.data.size();
+  }
+  memset(region.base + end, 0, m_size - end);
+}
+
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace hera {
+
+/// The address range reserved for a linear memory, the whole 32-bit address space.
+constexpr size_t memoryRegionSize = size_t(1) << 32;
+
+/// A reserved address range for a linear memory. Only the first @committed
+/// bytes are accessible, the rest is reserved without being backed.
+struct MemoryRegion {
+  char* base = nullptr;
+  size_t committed = 0;
+  // Bytes at the start mapped from a MemoryImage.
+  size_t imageMapped = 0;
+};
+
+/// Returns a region whose committed bytes all read as zero. Regions released on
+/// the calling thread are reused before a new one is mapped.
+///
+/// Only the Binaryen memory is backed by regions so far. WABT 1.0.5 keeps its
+/// memory in a std::vector and WAVM maps memories in its platform layer, neither
+/// takes an external allocation without patching the library. Their memories
+/// are reused with the pooled WABT environments and WAVM templates instead.
+/// @throws std::bad_alloc if the address range cannot be reserved.
+MemoryRegion acquireMemoryRegion();
+
+/// Returns @region to the pool of the calling thread. Only the first @dirty
+/// bytes may have been written to, they are cleared before the region is reused.
+void releaseMemoryRegion(MemoryRegion region, size_t dirty);
+
+/// The contents of a linear memory right after instantiation, shared by the
+/// instances of a contract. Only the pages which are not all zero, i.e. those
+/// written by data segments, are kept. Where memfd_create() is available they
+/// are written to a sparse anonymous file which is mapped copy-on-write, so
+/// instances only copy the pages they write to. Otherwise they are copied.
+class MemoryImage {
+public:
+  MemoryImage(char const* data, size_t size);
+  ~MemoryImage();
+
+  MemoryImage(MemoryImage const&) = delete;
+  MemoryImage& operator=(MemoryImage const&) = delete;
+
+  size_t size() const { return m_size; }
+
+  /// The bytes actually stored, without the zero pages.
+  size_t storedSize() const { return m_stored; }
+
+  /// Replaces the first size() bytes of @region, which must be committed, with the image.
+  void apply(MemoryRegion& region) const;
+
+private:
+  struct Chunk {
+    size_t offset;
+    std::vector<char> data;
+  };
+
+  size_t m_size;
+  size_t m_stored = 0;
+  int m_fd = -1;
+  // Only used without a file.
+  std::vector<Chunk> m_chunks;
+};
+
+}
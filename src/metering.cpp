@@ -0,0 +1,581 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string>
+
+#include "exceptions.h"
+#include "metering.h"
+
+using namespace std;
+
+namespace hera {
+
+namespace {
+
+enum class Section : uint8_t {
+  Custom = 0,
+  Type = 1,
+  Import = 2,
+  Global = 6,
+  Export = 7,
+  Start = 8,
+  Element = 9,
+  Code = 10
+};
+
+constexpr uint8_t functionForm = 0x60;
+constexpr uint8_t i64Type = 0x7e;
+constexpr uint8_t emptyBlockType = 0x40;
+constexpr uint8_t externalFunction = 0;
+constexpr uint8_t externalGlobal = 3;
+constexpr uint8_t mutableGlobal = 1;
+
+namespace opcode {
+constexpr uint8_t block = 0x02;
+constexpr uint8_t loop = 0x03;
+constexpr uint8_t if_ = 0x04;
+constexpr uint8_t else_ = 0x05;
+constexpr uint8_t end = 0x0b;
+constexpr uint8_t call = 0x10;
+constexpr uint8_t getGlobal = 0x23;
+constexpr uint8_t setGlobal = 0x24;
+constexpr uint8_t i64Const = 0x42;
+constexpr uint8_t i64LtU = 0x54;
+constexpr uint8_t i64Sub = 0x7d;
+}
+
+const string gasModule = "ethereum";
+const string gasField = "useGas";
+
+class Reader {
+public:
+  Reader(uint8_t const* _begin, uint8_t const* _end):
+    m_pos(_begin),
+    m_end(_end)
+  {}
+
+  bool atEnd() const { return m_pos == m_end; }
+  uint8_t const* position() const { return m_pos; }
+
+  uint8_t byte()
+  {
+    ensureAvailable(1);
+    return *m_pos++;
+  }
+
+  uint8_t const* bytes(size_t length)
+  {
+    ensureAvailable(length);
+    uint8_t const* ret = m_pos;
+    m_pos += length;
+    return ret;
+  }
+
+  uint32_t u32()
+  {
+    uint64_t ret = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+      uint8_t b = byte();
+      ret |= uint64_t(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+        ensureCondition(ret <= UINT32_MAX, ContractValidationFailure, "Integer out of range in module.");
+        return static_cast<uint32_t>(ret);
+      }
+    }
+    ensureCondition(false, ContractValidationFailure, "Integer too long in module.");
+    return 0;
+  }
+
+  void skipSigned(unsigned maxBytes)
+  {
+    for (unsigned i = 0; i < maxBytes; ++i)
+      if (!(byte() & 0x80))
+        return;
+    ensureCondition(false, ContractValidationFailure, "Integer too long in module.");
+  }
+
+  void skipName() { bytes(u32()); }
+
+private:
+  void ensureAvailable(size_t length)
+  {
+    ensureCondition(size_t(m_end - m_pos) >= length, ContractValidationFailure, "Unexpected end of module.");
+  }
+
+  uint8_t const* m_pos;
+  uint8_t const* m_end;
+};
+
+void writeU32(vector<uint8_t>& out, uint32_t value)
+{
+  do {
+    uint8_t b = value & 0x7f;
+    value >>= 7;
+    out.push_back(value ? (b | 0x80) : b);
+  } while (value);
+}
+
+void writeS64(vector<uint8_t>& out, int64_t value)
+{
+  while (true) {
+    uint8_t b = value & 0x7f;
+    value >>= 7;
+    if ((value == 0 && !(b & 0x40)) || (value == -1 && (b & 0x40))) {
+      out.push_back(b);
+      return;
+    }
+    out.push_back(b | 0x80);
+  }
+}
+
+void writeName(vector<uint8_t>& out, string const& name)
+{
+  writeU32(out, static_cast<uint32_t>(name.size()));
+  out.insert(out.end(), name.begin(), name.end());
+}
+
+void append(vector<uint8_t>& out, uint8_t const* begin, uint8_t const* end)
+{
+  out.insert(out.end(), begin, end);
+}
+
+// Reads the immediates of an instruction. @returns the callee of a call.
+uint32_t skipImmediates(Reader& reader, uint8_t op)
+{
+  switch (op) {
+  case opcode::block:
+  case opcode::loop:
+  case opcode::if_:
+    reader.byte(); // block type
+    return 0;
+  case 0x0c: // br
+  case 0x0d: // br_if
+    reader.u32();
+    return 0;
+  case 0x0e: { // br_table
+    uint32_t count = reader.u32();
+    for (uint32_t i = 0; i <= count; ++i)
+      reader.u32();
+    return 0;
+  }
+  case opcode::call:
+    return reader.u32();
+  case 0x11: // call_indirect
+    reader.u32();
+    reader.byte();
+    return 0;
+  case 0x3f: // memory.size
+  case 0x40: // memory.grow
+    reader.byte();
+    return 0;
+  case 0x41: // i32.const
+    reader.skipSigned(5);
+    return 0;
+  case opcode::i64Const:
+    reader.skipSigned(10);
+    return 0;
+  case 0x43: // f32.const
+    reader.bytes(4);
+    return 0;
+  case 0x44: // f64.const
+    reader.bytes(8);
+    return 0;
+  default:
+    break;
+  }
+
+  if (op >= 0x20 && op <= 0x24) { // local and global access
+    reader.u32();
+    return 0;
+  }
+  if (op >= 0x28 && op <= 0x3e) { // loads and stores
+    reader.u32();
+    reader.u32();
+    return 0;
+  }
+  bool plain = op <= 0x01 || op == opcode::else_ || op == opcode::end || op == 0x0f || op == 0x1a || op == 0x1b || (op >= 0x45 && op <= 0xbf);
+  ensureCondition(plain, ContractValidationFailure, "Unknown instruction in module.");
+  return 0;
+}
+
+class MeteringInjector {
+public:
+  MeteringInjector(vector<uint8_t> const& code, MeteringCharge charge):
+    m_code(code),
+    m_charge(charge)
+  {}
+
+  vector<uint8_t> inject()
+  {
+    ensureCondition(m_code.size() >= 8, ContractValidationFailure, "Module is too short.");
+    Reader reader(m_code.data() + 8, m_code.data() + m_code.size());
+    while (!reader.atEnd()) {
+      uint8_t id = reader.byte();
+      uint32_t size = reader.u32();
+      uint8_t const* payload = reader.bytes(size);
+      m_sections.emplace_back(id, vector<uint8_t>(payload, payload + size));
+    }
+
+    injectType();
+    injectImport();
+    if (m_charge == MeteringCharge::Counter)
+      injectCounter();
+
+    vector<uint8_t> ret(m_code.begin(), m_code.begin() + 8);
+    for (auto& section: m_sections) {
+      switch (static_cast<Section>(section.first)) {
+      case Section::Export:
+        section.second = rewriteExports(section.second);
+        break;
+      case Section::Start:
+        section.second = rewriteStart(section.second);
+        break;
+      case Section::Element:
+        section.second = rewriteElements(section.second);
+        break;
+      case Section::Code:
+        section.second = rewriteCode(section.second);
+        break;
+      default:
+        break;
+      }
+      ret.push_back(section.first);
+      writeU32(ret, static_cast<uint32_t>(section.second.size()));
+      ret.insert(ret.end(), section.second.begin(), section.second.end());
+    }
+    return ret;
+  }
+
+private:
+  typedef pair<uint8_t, vector<uint8_t>> SectionEntry;
+
+  // Returns the section with @id, inserted at its place if missing.
+  vector<uint8_t>& section(Section id)
+  {
+    auto it = m_sections.begin();
+    for (; it != m_sections.end(); ++it) {
+      if (it->first == static_cast<uint8_t>(id))
+        return it->second;
+      if (it->first != static_cast<uint8_t>(Section::Custom) && it->first > static_cast<uint8_t>(id))
+        break;
+    }
+    vector<uint8_t> empty;
+    writeU32(empty, 0);
+    return m_sections.insert(it, SectionEntry(static_cast<uint8_t>(id), empty))->second;
+  }
+
+  // Appends the signature of useGas: (i64) -> ().
+  void injectType()
+  {
+    vector<uint8_t>& types = section(Section::Type);
+    Reader reader(types.data(), types.data() + types.size());
+    m_gasType = reader.u32();
+
+    vector<uint8_t> payload;
+    writeU32(payload, m_gasType + 1);
+    append(payload, reader.position(), types.data() + types.size());
+    payload.push_back(functionForm);
+    writeU32(payload, 1);
+    payload.push_back(i64Type);
+    writeU32(payload, 0);
+    types = move(payload);
+  }
+
+  // Appends the import of useGas, which comes after the imported functions.
+  void injectImport()
+  {
+    vector<uint8_t>& imports = section(Section::Import);
+    Reader reader(imports.data(), imports.data() + imports.size());
+    uint32_t count = reader.u32();
+    uint8_t const* entries = reader.position();
+    m_gasFunction = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      reader.skipName();
+      reader.skipName();
+      switch (reader.byte()) {
+      case externalFunction:
+        reader.u32();
+        ++m_gasFunction;
+        break;
+      case 1: // table
+        reader.byte();
+        skipLimits(reader);
+        break;
+      case 2: // memory
+        skipLimits(reader);
+        break;
+      case externalGlobal:
+        reader.byte();
+        reader.byte();
+        ++m_importedGlobals;
+        break;
+      default:
+        ensureCondition(false, ContractValidationFailure, "Unknown import kind in module.");
+      }
+    }
+    ensureCondition(reader.atEnd(), ContractValidationFailure, "Malformed import section.");
+
+    vector<uint8_t> payload;
+    writeU32(payload, count + 1);
+    append(payload, entries, imports.data() + imports.size());
+    writeName(payload, gasModule);
+    writeName(payload, gasField);
+    payload.push_back(externalFunction);
+    writeU32(payload, m_gasType);
+    imports = move(payload);
+  }
+
+  // Appends the gas counter, a mutable i64 global initialized to 0. Globals
+  // defined by the module come after the imported ones, so no index changes.
+  void injectCounter()
+  {
+    vector<uint8_t>& globals = section(Section::Global);
+    Reader reader(globals.data(), globals.data() + globals.size());
+    uint32_t count = reader.u32();
+    m_counterGlobal = m_importedGlobals + count;
+
+    vector<uint8_t> payload;
+    writeU32(payload, count + 1);
+    append(payload, reader.position(), globals.data() + globals.size());
+    payload.push_back(i64Type);
+    payload.push_back(mutableGlobal);
+    payload.push_back(opcode::i64Const);
+    writeS64(payload, 0);
+    payload.push_back(opcode::end);
+    globals = move(payload);
+  }
+
+  // Charges @cost at the current position of @out.
+  void writeCharge(vector<uint8_t>& out, uint64_t cost) const
+  {
+    if (m_charge == MeteringCharge::Call) {
+      out.push_back(opcode::i64Const);
+      writeS64(out, static_cast<int64_t>(cost));
+      out.push_back(opcode::call);
+      writeU32(out, m_gasFunction);
+      return;
+    }
+
+    // if (counter < cost) useGas(cost); counter -= cost
+    out.push_back(opcode::getGlobal);
+    writeU32(out, m_counterGlobal);
+    out.push_back(opcode::i64Const);
+    writeS64(out, static_cast<int64_t>(cost));
+    out.push_back(opcode::i64LtU);
+    out.push_back(opcode::if_);
+    out.push_back(emptyBlockType);
+    out.push_back(opcode::i64Const);
+    writeS64(out, static_cast<int64_t>(cost));
+    out.push_back(opcode::call);
+    writeU32(out, m_gasFunction);
+    out.push_back(opcode::end);
+    out.push_back(opcode::getGlobal);
+    writeU32(out, m_counterGlobal);
+    out.push_back(opcode::i64Const);
+    writeS64(out, static_cast<int64_t>(cost));
+    out.push_back(opcode::i64Sub);
+    out.push_back(opcode::setGlobal);
+    writeU32(out, m_counterGlobal);
+  }
+
+  static void skipLimits(Reader& reader)
+  {
+    bool hasMaximum = reader.u32() != 0;
+    reader.u32();
+    if (hasMaximum)
+      reader.u32();
+  }
+
+  uint32_t shift(uint32_t function) const { return (function >= m_gasFunction) ? function + 1 : function; }
+
+  vector<uint8_t> rewriteExports(vector<uint8_t> const& exports) const
+  {
+    Reader reader(exports.data(), exports.data() + exports.size());
+    vector<uint8_t> payload;
+    uint32_t count = reader.u32();
+    writeU32(payload, count);
+    for (uint32_t i = 0; i < count; ++i) {
+      uint8_t const* name = reader.position();
+      reader.skipName();
+      append(payload, name, reader.position());
+      uint8_t kind = reader.byte();
+      payload.push_back(kind);
+      uint32_t index = reader.u32();
+      writeU32(payload, (kind == externalFunction) ? shift(index) : index);
+    }
+    ensureCondition(reader.atEnd(), ContractValidationFailure, "Malformed export section.");
+    return payload;
+  }
+
+  vector<uint8_t> rewriteStart(vector<uint8_t> const& start) const
+  {
+    Reader reader(start.data(), start.data() + start.size());
+    vector<uint8_t> payload;
+    writeU32(payload, shift(reader.u32()));
+    ensureCondition(reader.atEnd(), ContractValidationFailure, "Malformed start section.");
+    return payload;
+  }
+
+  vector<uint8_t> rewriteElements(vector<uint8_t> const& elements) const
+  {
+    Reader reader(elements.data(), elements.data() + elements.size());
+    vector<uint8_t> payload;
+    uint32_t count = reader.u32();
+    writeU32(payload, count);
+    for (uint32_t i = 0; i < count; ++i) {
+      // The table index and the offset expression are copied.
+      uint8_t const* begin = reader.position();
+      reader.u32();
+      uint8_t op;
+      do {
+        op = reader.byte();
+        skipImmediates(reader, op);
+      } while (op != opcode::end);
+      append(payload, begin, reader.position());
+
+      uint32_t functions = reader.u32();
+      writeU32(payload, functions);
+      for (uint32_t j = 0; j < functions; ++j)
+        writeU32(payload, shift(reader.u32()));
+    }
+    ensureCondition(reader.atEnd(), ContractValidationFailure, "Malformed element section.");
+    return payload;
+  }
+
+  vector<uint8_t> rewriteCode(vector<uint8_t> const& code) const
+  {
+    Reader reader(code.data(), code.data() + code.size());
+    vector<uint8_t> payload;
+    uint32_t count = reader.u32();
+    writeU32(payload, count);
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t size = reader.u32();
+      uint8_t const* body = reader.bytes(size);
+      vector<uint8_t> metered = meterBody(body, body + size);
+      writeU32(payload, static_cast<uint32_t>(metered.size()));
+      payload.insert(payload.end(), metered.begin(), metered.end());
+    }
+    ensureCondition(reader.atEnd(), ContractValidationFailure, "Malformed code section.");
+    return payload;
+  }
+
+  struct Instruction {
+    uint8_t const* begin;
+    uint8_t const* end;
+    uint8_t op;
+    uint32_t callee;
+  };
+
+  struct MeteredBlock {
+    size_t start;
+    uint64_t cost;
+  };
+
+  vector<uint8_t> meterBody(uint8_t const* begin, uint8_t const* end) const
+  {
+    Reader reader(begin, end);
+    uint32_t localEntries = reader.u32();
+    for (uint32_t i = 0; i < localEntries; ++i) {
+      reader.u32();
+      reader.byte();
+    }
+    uint8_t const* instructionsBegin = reader.position();
+
+    vector<Instruction> instructions;
+    size_t depth = 1;
+    while (depth > 0) {
+      Instruction instruction;
+      instruction.begin = reader.position();
+      instruction.op = reader.byte();
+      instruction.callee = skipImmediates(reader, instruction.op);
+      instruction.end = reader.position();
+      instructions.push_back(instruction);
+
+      if (instruction.op == opcode::block || instruction.op == opcode::loop || instruction.op == opcode::if_)
+        ++depth;
+      else if (instruction.op == opcode::end)
+        --depth;
+    }
+    ensureCondition(reader.atEnd(), ContractValidationFailure, "Malformed function body.");
+
+    // Blocks are recorded in the order they begin, which is the order of their start.
+    vector<MeteredBlock> blocks;
+    vector<size_t> open;
+    auto beginBlock = [&](size_t start) {
+      open.push_back(blocks.size());
+      blocks.push_back(MeteredBlock{start, 1});
+    };
+    auto endBlock = [&]() {
+      ensureCondition(!open.empty(), ContractValidationFailure, "Unbalanced blocks in function body.");
+      open.pop_back();
+    };
+
+    beginBlock(0);
+    for (size_t i = 0; i < instructions.size(); ++i) {
+      switch (instructions[i].op) {
+      case opcode::block:
+      case opcode::loop:
+      case opcode::if_:
+        blocks[open.back()].cost += 1;
+        beginBlock(i + 1);
+        break;
+      case opcode::else_:
+        endBlock();
+        beginBlock(i + 1);
+        break;
+      case opcode::end:
+        endBlock();
+        break;
+      default:
+        blocks[open.back()].cost += 1;
+        break;
+      }
+    }
+
+    vector<uint8_t> ret(begin, instructionsBegin);
+    auto block = blocks.begin();
+    for (size_t i = 0; i < instructions.size(); ++i) {
+      if (block != blocks.end() && block->start == i) {
+        writeCharge(ret, block->cost);
+        ++block;
+      }
+      if (instructions[i].op == opcode::call) {
+        ret.push_back(opcode::call);
+        writeU32(ret, shift(instructions[i].callee));
+      } else {
+        append(ret, instructions[i].begin, instructions[i].end);
+      }
+    }
+    return ret;
+  }
+
+  vector<uint8_t> const& m_code;
+  MeteringCharge m_charge;
+  vector<SectionEntry> m_sections;
+  uint32_t m_gasType = 0;
+  uint32_t m_gasFunction = 0;
+  uint32_t m_importedGlobals = 0;
+  uint32_t m_counterGlobal = 0;
+};
+
+}
+
+vector<uint8_t> injectMetering(vector<uint8_t> const& code, MeteringCharge charge)
+{
+  return MeteringInjector(code, charge).inject();
+}
+
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace hera {
+
+/// How the code injected by injectMetering() charges gas.
+enum class MeteringCharge {
+  /// By calling ethereum::useGas at the start of each metered block, like the Sentinel.
+  Call,
+  /// By subtracting from a mutable i64 global appended to the module, the gas
+  /// counter. It is checked first: ethereum::useGas is only called with the
+  /// cost of the block if the counter is lower, to end the execution. The
+  /// engine keeps the gas left in the counter (see metering=native).
+  Counter
+};
+
+/// Injects gas metering into a contract, the transformation done by the
+/// Sentinel system contract, without executing it.
+///
+/// An import of ethereum::useGas is appended (with a new signature), and the
+/// indices of the functions defined by the contract are shifted past it. Each
+/// metered block starts with a call charging one gas per instruction up to its
+/// end: the body of a function, and what follows each block, loop, if and else.
+/// A block is charged one more for its end, like the reference implementation.
+///
+/// The sections which are not affected are copied as they are, and so are the
+/// instructions except for the indices of calls.
+///
+/// Both ways of charging use the same metered blocks and costs.
+///
+/// @throws ContractValidationFailure if @code is not a well-formed module.
+std::vector<uint8_t> injectMetering(std::vector<uint8_t> const& code, MeteringCharge charge = MeteringCharge::Call);
+
+}
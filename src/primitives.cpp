@@ -0,0 +1,224 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "primitives.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HERA_PRIMITIVES_X86 1
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace hera {
+
+namespace {
+
+uint64_t load64(uint8_t const* data)
+{
+  uint64_t ret;
+  memcpy(&ret, data, sizeof(ret));
+  return ret;
+}
+
+void store64(uint8_t* data, uint64_t value)
+{
+  memcpy(data, &value, sizeof(value));
+}
+
+// Scalar versions, these work on every platform.
+
+void reverse16Scalar(uint8_t const* src, uint8_t* dst)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  uint64_t low = load64(src);
+  uint64_t high = load64(src + 8);
+  store64(dst, __builtin_bswap64(high));
+  store64(dst + 8, __builtin_bswap64(low));
+#else
+  reverse_copy(src, src + 16, dst);
+#endif
+}
+
+void reverse32Scalar(uint8_t const* src, uint8_t* dst)
+{
+  reverse16Scalar(src + 16, dst);
+  reverse16Scalar(src, dst + 16);
+}
+
+#if HERA_PRIMITIVES_X86
+
+__attribute__((target("ssse3")))
+void reverse16Ssse3(uint8_t const* src, uint8_t* dst)
+{
+  const __m128i mask = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i value = _mm_loadu_si128(reinterpret_cast<__m128i const*>(src));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi8(value, mask));
+}
+
+__attribute__((target("ssse3")))
+void reverse32Ssse3(uint8_t const* src, uint8_t* dst)
+{
+  reverse16Ssse3(src + 16, dst);
+  reverse16Ssse3(src, dst + 16);
+}
+
+__attribute__((target("avx2")))
+void reverse32Avx2(uint8_t const* src, uint8_t* dst)
+{
+  // vpshufb only shuffles within 128 bit lanes, the lanes are swapped afterwards.
+  const __m256i mask = _mm256_set_epi8(
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+  );
+  __m256i value = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(src));
+  value = _mm256_shuffle_epi8(value, mask);
+  value = _mm256_permute4x64_epi64(value, 0x4e);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), value);
+}
+
+// SSE2 is part of the x86-64 baseline, no dispatch is needed.
+bool isZero16(uint8_t const* data)
+{
+  __m128i value = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(value, _mm_setzero_si128())) == 0xffff;
+}
+
+bool isZero32(uint8_t const* data)
+{
+  __m128i value = _mm_or_si128(
+    _mm_loadu_si128(reinterpret_cast<__m128i const*>(data)),
+    _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + 16))
+  );
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(value, _mm_setzero_si128())) == 0xffff;
+}
+
+#else
+
+bool isZero16(uint8_t const* data)
+{
+  return (load64(data) | load64(data + 8)) == 0;
+}
+
+bool isZero32(uint8_t const* data)
+{
+  return (load64(data) | load64(data + 8) | load64(data + 16) | load64(data + 24)) == 0;
+}
+
+#endif
+
+struct Implementation {
+  void (*reverse16)(uint8_t const*, uint8_t*);
+  void (*reverse32)(uint8_t const*, uint8_t*);
+};
+
+// @returns false if the CPU does not support @which.
+bool makeImplementation(PrimitivesImplementation which, Implementation & ret)
+{
+  switch (which) {
+#if HERA_PRIMITIVES_X86
+  case PrimitivesImplementation::Avx2:
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2"))
+      return false;
+    ret = Implementation{reverse16Ssse3, reverse32Avx2};
+    return true;
+  case PrimitivesImplementation::Ssse3:
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("ssse3"))
+      return false;
+    ret = Implementation{reverse16Ssse3, reverse32Ssse3};
+    return true;
+#else
+  case PrimitivesImplementation::Avx2:
+  case PrimitivesImplementation::Ssse3:
+    return false;
+#endif
+  case PrimitivesImplementation::Scalar:
+    ret = Implementation{reverse16Scalar, reverse32Scalar};
+    return true;
+  }
+  return false;
+}
+
+Implementation selectImplementation()
+{
+  Implementation ret;
+  if (!makeImplementation(PrimitivesImplementation::Avx2, ret) && !makeImplementation(PrimitivesImplementation::Ssse3, ret))
+    makeImplementation(PrimitivesImplementation::Scalar, ret);
+  return ret;
+}
+
+Implementation& implementation()
+{
+  static Implementation selected = selectImplementation();
+  return selected;
+}
+
+}
+
+void reverseBytes(uint8_t const* src, uint8_t* dst, size_t length)
+{
+  switch (length) {
+  case 16:
+    implementation().reverse16(src, dst);
+    break;
+  case 32:
+    implementation().reverse32(src, dst);
+    break;
+  default:
+    reverse_copy(src, src + length, dst);
+    break;
+  }
+}
+
+bool isZeroBytes(uint8_t const* data, size_t length)
+{
+  switch (length) {
+  case 16:
+    return isZero16(data);
+  case 32:
+    return isZero32(data);
+  default:
+    return all_of(data, data + length, [](uint8_t b) { return b == 0; });
+  }
+}
+
+bool selectPrimitives(PrimitivesImplementation which)
+{
+  return makeImplementation(which, implementation());
+}
+
+unsigned __int128 loadBigEndian128(uint8_t const* data)
+{
+#if (defined(__GNUC__) || defined(__clang__)) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t high = __builtin_bswap64(load64(data));
+  uint64_t low = __builtin_bswap64(load64(data + 8));
+  return (static_cast<unsigned __int128>(high) << 64) | low;
+#else
+  unsigned __int128 ret = 0;
+  for (unsigned i = 0; i < 16; i++) {
+    ret <<= 8;
+    ret |= data[i];
+  }
+  return ret;
+#endif
+}
+
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace hera {
+
+// Byte level primitives for the 128 and 256 bit values passed through the EEI.
+// The implementation is selected once at startup based on the CPU features.
+
+/// Copies @length bytes from @src to @dst in reverse order. The ranges must not overlap.
+void reverseBytes(uint8_t const* src, uint8_t* dst, size_t length);
+
+/// @returns true if all @length bytes at @data are zero.
+bool isZeroBytes(uint8_t const* data, size_t length);
+
+/// Loads a big-endian 128 bit number.
+unsigned __int128 loadBigEndian128(uint8_t const* data);
+
+/// The implementations of reverseBytes() to select from.
+enum class PrimitivesImplementation {
+  Scalar,
+  Ssse3,
+  Avx2
+};
+
+/// Replaces the implementation selected at startup, so that tests can compare
+/// all of them. Not thread-safe, must not be called while executing.
+/// @returns false if the CPU does not support @implementation.
+bool selectPrimitives(PrimitivesImplementation implementation);
+
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <pthread.h>
+
+namespace hera {
+
+/// A reader-writer lock, as std::shared_mutex is not available in C++11.
+/// Exclusive access works with std::lock_guard and std::unique_lock, shared
+/// access with SharedLock.
+class SharedMutex {
+public:
+  SharedMutex() { pthread_rwlock_init(&m_lock, nullptr); }
+  ~SharedMutex() { pthread_rwlock_destroy(&m_lock); }
+
+  SharedMutex(SharedMutex const&) = delete;
+  SharedMutex& operator=(SharedMutex const&) = delete;
+
+  void lock() { pthread_rwlock_wrlock(&m_lock); }
+  void unlock() { pthread_rwlock_unlock(&m_lock); }
+  void lock_shared() { pthread_rwlock_rdlock(&m_lock); }
+  void unlock_shared() { pthread_rwlock_unlock(&m_lock); }
+
+private:
+  pthread_rwlock_t m_lock;
+};
+
+/// Holds a SharedMutex in shared mode for its lifetime.
+class SharedLock {
+public:
+  explicit SharedLock(SharedMutex& _mutex): m_mutex(_mutex) { m_mutex.lock_shared(); }
+  ~SharedLock() { m_mutex.unlock_shared(); }
+
+  SharedLock(SharedLock const&) = delete;
+  SharedLock& operator=(SharedLock const&) = delete;
+
+private:
+  SharedMutex& m_mutex;
+};
+
+}
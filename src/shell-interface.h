@@ -21,9 +21,18 @@
 #ifndef wasm_shell_interface_h
 #define wasm_shell_interface_h
 
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
 #include <wasm.h>
 #include <wasm-interpreter.h>
 
+#include "memory-region.h"
+
 namespace wasm {
 
 struct ExitException {};
@@ -35,51 +44,75 @@ struct ShellExternalInterface : ModuleInstance::ExternalInterface {
   // properly. Avoid emitting unaligned load/store by checking for alignment
   // explicitly, and performing memcpy if unaligned.
   //
-  // The allocated memory tries to have the same alignment as the memory being
-  // simulated.
+  // The memory is a reservation of the whole 32-bit address space, which is
+  // made accessible as it grows. Growing never moves or copies the contents,
+  // and pages are zeroed by the kernel when first touched. Reservations are
+  // recycled between instances, see hera/memory-region.h.
   class Memory {
     // Use char because it doesn't run afoul of aliasing rules.
-    std::vector<char> memory;
+    hera::MemoryRegion region;
+    size_t used = 0;
+    // The largest size since the region was acquired, nothing beyond has been written.
+    size_t highWater = 0;
     template <typename T>
     static bool aligned(const char* address) {
       static_assert(!(sizeof(T) & (sizeof(T) - 1)), "must be a power of 2");
       return 0 == (reinterpret_cast<uintptr_t>(address) & (sizeof(T) - 1));
     }
+    static size_t roundToSystemPage(size_t size) {
+      static const size_t systemPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      return (size + systemPageSize - 1) / systemPageSize * systemPageSize;
+    }
     Memory(Memory&) = delete;
     Memory& operator=(const Memory&) = delete;
 
    public:
     Memory() {}
-    size_t size() const { return memory.size(); }
+    ~Memory() {
+      hera::releaseMemoryRegion(region, highWater);
+    }
+    size_t size() const { return used; }
+    char* data() { return region.base; }
     void resize(size_t newSize) {
-      // Ensure the smallest allocation is large enough that most allocators
-      // will provide page-aligned storage. This hopefully allows the
-      // interpreter's memory to be as aligned as the memory being simulated,
-      // ensuring that the performance doesn't needlessly degrade.
-      //
-      // The code is optimistic this will work until WG21's p0035r0 happens.
-      const size_t minSize = 1 << 12;
-      size_t oldSize = memory.size();
-      memory.resize(std::max(minSize, newSize));
-      if (newSize < oldSize && newSize < minSize) {
-        std::memset(&memory[newSize], 0, minSize - newSize);
+      if (newSize > hera::memoryRegionSize) {
+        throw std::bad_alloc();
       }
+      if (!region.base) {
+        region = hera::acquireMemoryRegion();
+      }
+      size_t newCommitted = roundToSystemPage(newSize);
+      if (newCommitted > region.committed) {
+        if (mprotect(region.base + region.committed, newCommitted - region.committed, PROT_READ | PROT_WRITE) != 0) {
+          throw std::bad_alloc();
+        }
+        region.committed = newCommitted;
+      }
+      if (newSize < used) {
+        // Memory never shrinks during an execution, this is only for completeness.
+        std::memset(region.base + newSize, 0, used - newSize);
+      }
+      used = newSize;
+      highWater = std::max(highWater, used);
+    }
+    void assign(const hera::MemoryImage& image) {
+      resize(image.size());
+      image.apply(region);
     }
     template <typename T>
     void set(size_t address, T value) {
-      if (aligned<T>(&memory[address])) {
-        *reinterpret_cast<T*>(&memory[address]) = value;
+      if (aligned<T>(&region.base[address])) {
+        *reinterpret_cast<T*>(&region.base[address]) = value;
       } else {
-        std::memcpy(&memory[address], &value, sizeof(T));
+        std::memcpy(&region.base[address], &value, sizeof(T));
       }
     }
     template <typename T>
     T get(size_t address) {
-      if (aligned<T>(&memory[address])) {
-        return *reinterpret_cast<T*>(&memory[address]);
+      if (aligned<T>(&region.base[address])) {
+        return *reinterpret_cast<T*>(&region.base[address]);
       } else {
         T loaded;
-        std::memcpy(&loaded, &memory[address], sizeof(T));
+        std::memcpy(&loaded, &region.base[address], sizeof(T));
         return loaded;
       }
     }
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "binaryen.h"
+#include "debugging.h"
+#include "exceptions.h"
+#include "tiered.h"
+#include "wavm.h"
+
+using namespace std;
+
+namespace hera {
+
+namespace {
+
+// Executions after which a contract is compiled.
+constexpr uint64_t promotionThreshold = 16;
+
+// A prepared module of both tiers.
+struct TieredModule : PreparedModule {
+  vector<uint8_t> code;
+  shared_ptr<PreparedModule const> interpreted;
+  // Set once by the background thread, accessed with atomic_load() and atomic_store().
+  mutable shared_ptr<PreparedModule const> compiled;
+  mutable atomic<uint64_t> executions{0};
+  mutable atomic<bool> promoted{false};
+
+  // The compiled module is not known yet when the module is cached, it is
+  // charged up front with the estimate of the compiler for its code.
+  size_t memoryCost() const override { return interpreted->memoryCost() + code.size() + code.size() * 8; }
+};
+
+}
+
+// A pool of background threads compiling hot contracts.
+class TierPromoter {
+public:
+  explicit TierPromoter(WavmEngine& _compiler):
+    m_compiler(_compiler)
+  {
+    unsigned threads = max(1u, thread::hardware_concurrency() / 4);
+    for (unsigned i = 0; i < threads; ++i)
+      m_threads.emplace_back(&TierPromoter::work, this);
+  }
+
+  ~TierPromoter()
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stop = true;
+      m_queue.clear();
+    }
+    m_wakeup.notify_all();
+    for (auto& t: m_threads)
+      t.join();
+  }
+
+  void promote(shared_ptr<TieredModule const> const& module)
+  {
+    {
+      lock_guard<mutex> lock(m_mutex);
+      // Modules evicted from the cache before their turn are not compiled.
+      m_queue.push_back(module);
+    }
+    m_wakeup.notify_one();
+  }
+
+private:
+  void work()
+  {
+    while (true) {
+      shared_ptr<TieredModule const> module;
+      {
+        unique_lock<mutex> lock(m_mutex);
+        m_wakeup.wait(lock, [&]{ return m_stop || !m_queue.empty(); });
+        if (m_stop)
+          return;
+        module = m_queue.front().lock();
+        m_queue.pop_front();
+      }
+      if (module)
+        compile(*module);
+    }
+  }
+
+  void compile(TieredModule const& module)
+  {
+    try {
+      shared_ptr<PreparedModule const> compiled = m_compiler.prepare(module.code);
+      // Pinned on the module, it is not dropped even if the idle budget is exhausted.
+      m_compiler.precompile(compiled);
+      atomic_store(&module.compiled, compiled);
+      HERA_DEBUG << "Promoted contract (" << module.code.size() << " bytes) to the compiler\n";
+    } catch (exception const& e) {
+      // The contract stays in the interpreter, e.g. if it uses an import the compiler lacks.
+      HERA_DEBUG << "Failed to promote contract: " << e.what() << "\n";
+    }
+  }
+
+  WavmEngine& m_compiler;
+  mutex m_mutex;
+  condition_variable m_wakeup;
+  deque<weak_ptr<TieredModule const>> m_queue;
+  bool m_stop = false;
+  vector<thread> m_threads;
+};
+
+unique_ptr<WasmEngine> TieredEngine::create()
+{
+  return unique_ptr<WasmEngine>{new TieredEngine};
+}
+
+TieredEngine::TieredEngine():
+  m_interpreter(BinaryenEngine::create()),
+  m_compiler(new WavmEngine),
+  m_promoter(new TierPromoter(*m_compiler))
+{
+}
+
+TieredEngine::~TieredEngine() noexcept = default;
+
+shared_ptr<PreparedModule const> TieredEngine::prepare(vector<uint8_t> const& code)
+{
+  auto module = make_shared<TieredModule>();
+  module->code = code;
+  module->interpreted = m_interpreter->prepare(code);
+  return module;
+}
+
+unique_ptr<WasmInstance> TieredEngine::instantiate(shared_ptr<PreparedModule const> module)
+{
+  auto tieredModule = dynamic_pointer_cast<TieredModule const>(module);
+  heraAssert(tieredModule, "Module was not prepared by the tiered engine.");
+
+  shared_ptr<PreparedModule const> compiled = atomic_load(&tieredModule->compiled);
+  if (compiled)
+    return m_compiler->instantiate(move(compiled));
+
+  if (tieredModule->executions.fetch_add(1, memory_order_relaxed) + 1 >= promotionThreshold &&
+      !tieredModule->promoted.exchange(true, memory_order_relaxed))
+    m_promoter->promote(tieredModule);
+
+  return m_interpreter->instantiate(tieredModule->interpreted);
+}
+
+void TieredEngine::verifyContract(vector<uint8_t> const& code)
+{
+  m_interpreter->verifyContract(code);
+}
+
+}
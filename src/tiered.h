@@ -0,0 +1,53 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <memory>
+
+#include "eei.h"
+
+namespace hera {
+
+class TierPromoter;
+class WavmEngine;
+
+/// Runs contracts in the Binaryen interpreter until they were executed often
+/// enough, then compiles them with WAVM on a background thread. Once the
+/// compiled module is ready, new executions switch to it. Executions which
+/// already started are not affected.
+class TieredEngine : public WasmEngine {
+public:
+  /// Factory method to create the tiered Wasm Engine.
+  static std::unique_ptr<WasmEngine> create();
+
+  TieredEngine();
+  ~TieredEngine() noexcept override;
+
+  std::shared_ptr<PreparedModule const> prepare(std::vector<uint8_t> const& code) override;
+
+  std::unique_ptr<WasmInstance> instantiate(std::shared_ptr<PreparedModule const> module) override;
+
+  void verifyContract(std::vector<uint8_t> const& code) override;
+
+private:
+  std::unique_ptr<WasmEngine> m_interpreter;
+  std::unique_ptr<WavmEngine> m_compiler;
+  // Declared last, so that the background threads are stopped first.
+  std::unique_ptr<TierPromoter> m_promoter;
+};
+
+}
@@ -0,0 +1,294 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "trace-format.h"
+
+using namespace std;
+
+namespace hera {
+
+namespace {
+
+// Dictionaries stop growing beyond this, further values are written as literals.
+constexpr size_t maxDictionarySize = 65536;
+
+}
+
+size_t formatTraceRecord(TraceRecord const& record, char* out)
+{
+  char* const start = out;
+  auto append = [&](char const* str) {
+    size_t length = strlen(str);
+    memcpy(out, str, length);
+    out += length;
+  };
+  auto appendHex = [&](evmc_bytes32 const& word) {
+    static char const digits[] = "0123456789abcdef";
+    for (uint8_t b: word.bytes) {
+      *out++ = digits[b >> 4];
+      *out++ = digits[b & 0xf];
+    }
+  };
+
+  switch (record.event) {
+  case TraceEvent::StorageStore:
+    append("SSTORE: ");
+    appendHex(record.words[0]);
+    append(" ");
+    appendHex(record.words[1]);
+    break;
+  case TraceEvent::StorageLoad:
+    append("SLOAD: ");
+    appendHex(record.words[0]);
+    break;
+  case TraceEvent::Log:
+    out += sprintf(out, "LOG: %x %x", record.dataOffset, record.length);
+    for (unsigned i = 0; i < record.numberOfTopics && i < 4; i++) {
+      append(" ");
+      appendHex(record.words[i]);
+    }
+    break;
+  case TraceEvent::Call: append("CALL: "); break;
+  case TraceEvent::CallCode: append("CALLCODE: "); break;
+  case TraceEvent::CallDelegate: append("CALLDELEGATE: "); break;
+  case TraceEvent::CallStatic: append("CALLSTATIC: "); break;
+  case TraceEvent::SelfDestruct: append("SUICIDE: "); break;
+  case TraceEvent::TransactionBegin:
+  case TraceEvent::TransactionEnd:
+    return 0;
+  }
+  *out++ = '\n';
+  return static_cast<size_t>(out - start);
+}
+
+void putVarint(string & out, uint64_t value)
+{
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+bool getVarint(uint8_t const*& in, uint8_t const* end, uint64_t & value)
+{
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (in == end)
+      return false;
+    uint8_t b = *in++;
+    value |= uint64_t(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+void TraceBlockEncoder::begin(uint64_t sequence, evmc_address const& recipient)
+{
+  m_open = true;
+  m_empty = true;
+  m_sequence = sequence;
+  m_payload.clear();
+  m_accounts.clear();
+  m_words.clear();
+  m_lastAccount = recipient;
+  putVarint(m_payload, sequence);
+  m_payload.append(reinterpret_cast<char const*>(recipient.bytes), sizeof(recipient.bytes));
+}
+
+void TraceBlockEncoder::add(TraceRecord const& record)
+{
+  bool accountChanged = memcmp(record.account.bytes, m_lastAccount.bytes, sizeof(m_lastAccount.bytes)) != 0;
+  uint8_t tag = static_cast<uint8_t>(record.event);
+  m_payload.push_back(static_cast<char>(accountChanged ? (tag | traceAccountFlag) : tag));
+  if (accountChanged) {
+    putAccount(record.account);
+    m_lastAccount = record.account;
+  }
+
+  switch (record.event) {
+  case TraceEvent::StorageStore:
+    putWord(record.words[0]);
+    putWord(record.words[1]);
+    break;
+  case TraceEvent::StorageLoad:
+    putWord(record.words[0]);
+    break;
+  case TraceEvent::Log: {
+    uint8_t numberOfTopics = min<uint8_t>(record.numberOfTopics, 4);
+    putVarint(m_payload, record.dataOffset);
+    putVarint(m_payload, record.length);
+    m_payload.push_back(static_cast<char>(numberOfTopics));
+    for (unsigned i = 0; i < numberOfTopics; i++)
+      putWord(record.words[i]);
+    break;
+  }
+  default:
+    break;
+  }
+  m_empty = false;
+}
+
+string TraceBlockEncoder::finish()
+{
+  m_open = false;
+  string ret;
+  ret.swap(m_payload);
+  return ret;
+}
+
+void TraceBlockEncoder::putAccount(evmc_address const& account)
+{
+  string key(reinterpret_cast<char const*>(account.bytes), sizeof(account.bytes));
+  auto it = m_accounts.find(key);
+  if (it != m_accounts.end()) {
+    putVarint(m_payload, it->second);
+    return;
+  }
+  putVarint(m_payload, 0);
+  m_payload.append(key);
+  if (m_accounts.size() < maxDictionarySize)
+    m_accounts.emplace(move(key), m_accounts.size() + 1);
+}
+
+void TraceBlockEncoder::putWord(evmc_bytes32 const& word)
+{
+  string key(reinterpret_cast<char const*>(word.bytes), sizeof(word.bytes));
+  auto it = m_words.find(key);
+  if (it != m_words.end()) {
+    putVarint(m_payload, it->second);
+    return;
+  }
+  putVarint(m_payload, 0);
+  m_payload.append(key);
+  if (m_words.size() < maxDictionarySize)
+    m_words.emplace(move(key), m_words.size() + 1);
+}
+
+TraceBlockDecoder::TraceBlockDecoder(uint8_t const* payload, size_t length):
+  m_in(payload),
+  m_end(payload + length)
+{}
+
+bool TraceBlockDecoder::begin(uint64_t & sequence, evmc_address & recipient)
+{
+  if (!getVarint(m_in, m_end, sequence) || static_cast<size_t>(m_end - m_in) < sizeof(recipient.bytes)) {
+    m_malformed = true;
+    return false;
+  }
+  memcpy(recipient.bytes, m_in, sizeof(recipient.bytes));
+  m_in += sizeof(recipient.bytes);
+  m_lastAccount = recipient;
+  return true;
+}
+
+bool TraceBlockDecoder::next(TraceRecord & record)
+{
+  if (m_in == m_end)
+    return false;
+
+  record = TraceRecord{};
+  uint8_t tag = *m_in++;
+  uint8_t event = tag & ~traceAccountFlag;
+  if (event < static_cast<uint8_t>(TraceEvent::StorageStore) || event > static_cast<uint8_t>(TraceEvent::SelfDestruct)) {
+    m_malformed = true;
+    return false;
+  }
+  record.event = static_cast<TraceEvent>(event);
+
+  if ((tag & traceAccountFlag) && !getAccount(m_lastAccount)) {
+    m_malformed = true;
+    return false;
+  }
+  record.account = m_lastAccount;
+
+  bool ok = true;
+  switch (record.event) {
+  case TraceEvent::StorageStore:
+    ok = getWord(record.words[0]) && getWord(record.words[1]);
+    break;
+  case TraceEvent::StorageLoad:
+    ok = getWord(record.words[0]);
+    break;
+  case TraceEvent::Log: {
+    uint64_t dataOffset = 0;
+    uint64_t length = 0;
+    ok = getVarint(m_in, m_end, dataOffset) && getVarint(m_in, m_end, length) && m_in != m_end;
+    if (!ok)
+      break;
+    record.dataOffset = static_cast<uint32_t>(dataOffset);
+    record.length = static_cast<uint32_t>(length);
+    record.numberOfTopics = *m_in++;
+    ok = record.numberOfTopics <= 4;
+    for (unsigned i = 0; ok && i < record.numberOfTopics; i++)
+      ok = getWord(record.words[i]);
+    break;
+  }
+  default:
+    break;
+  }
+
+  if (!ok)
+    m_malformed = true;
+  return ok;
+}
+
+bool TraceBlockDecoder::getAccount(evmc_address & account)
+{
+  uint64_t ref;
+  if (!getVarint(m_in, m_end, ref))
+    return false;
+  if (ref != 0) {
+    if (ref > m_accounts.size())
+      return false;
+    account = m_accounts[ref - 1];
+    return true;
+  }
+  if (static_cast<size_t>(m_end - m_in) < sizeof(account.bytes))
+    return false;
+  memcpy(account.bytes, m_in, sizeof(account.bytes));
+  m_in += sizeof(account.bytes);
+  if (m_accounts.size() < maxDictionarySize)
+    m_accounts.push_back(account);
+  return true;
+}
+
+bool TraceBlockDecoder::getWord(evmc_bytes32 & word)
+{
+  uint64_t ref;
+  if (!getVarint(m_in, m_end, ref))
+    return false;
+  if (ref != 0) {
+    if (ref > m_words.size())
+      return false;
+    word = m_words[ref - 1];
+    return true;
+  }
+  if (static_cast<size_t>(m_end - m_in) < sizeof(word.bytes))
+    return false;
+  memcpy(word.bytes, m_in, sizeof(word.bytes));
+  m_in += sizeof(word.bytes);
+  if (m_words.size() < maxDictionarySize)
+    m_words.push_back(word);
+  return true;
+}
+
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <evmc/evmc.h>
+
+namespace hera {
+
+/// The state accesses recorded in the trace.
+enum class TraceEvent : uint8_t {
+  StorageStore = 1,
+  StorageLoad,
+  Log,
+  Call,
+  CallCode,
+  CallDelegate,
+  CallStatic,
+  SelfDestruct,
+  // Delimit the records of a transaction, not written as text.
+  TransactionBegin,
+  TransactionEnd
+};
+
+/// A single trace entry. It is formatted by the writer thread, so the
+/// executing thread only copies the raw values.
+struct TraceRecord {
+  TraceEvent event;
+  uint8_t numberOfTopics;
+  uint32_t dataOffset;
+  uint32_t length;
+  /// The executing account (the recipient for TransactionBegin).
+  evmc_address account;
+  /// The sequence number of the transaction (TransactionBegin only).
+  uint64_t sequence;
+  /// SSTORE: path and value, SLOAD: path, LOG: topics.
+  evmc_bytes32 words[4];
+};
+
+/// Formats @record as a line of the text trace (including the newline).
+/// @returns the number of characters written to @out, which must hold at least
+/// traceMaxLineLength characters. Nothing is written for transaction delimiters.
+size_t formatTraceRecord(TraceRecord const& record, char* out);
+
+constexpr size_t traceMaxLineLength = 320;
+
+/// The binary trace consists of a data file and an index file.
+///
+/// The data file starts with traceDataMagic and continues with one block per
+/// transaction: a varint payload length followed by the payload. The payload
+/// starts with the sequence number (varint) and the recipient (20 bytes) of
+/// the transaction, and is followed by the records. Each record starts with
+/// its TraceEvent as a tag byte. If traceAccountFlag is set in the tag, the
+/// executing account follows, otherwise it is the same as in the previous
+/// record. Then, depending on the event:
+///
+///   SSTORE:  path, value
+///   SLOAD:   path
+///   LOG:     data offset (varint), data length (varint), topic count (u8), topics
+///
+/// Accounts and 32-byte words are written as a varint reference into a
+/// dictionary local to the block: 0 means a literal (20 or 32 bytes) follows
+/// and is added to the dictionary, n refers to the n-th entry added. Every
+/// block can thus be decoded on its own.
+///
+/// The index file starts with traceIndexMagic and has a fixed-size entry per
+/// transaction: sequence number, payload offset and payload length as
+/// little-endian u64s. Sequence numbers count the transactions of a trace from
+/// 0, continuing when it is appended to by another process, and the entry of
+/// transaction n is at offset 8 + n * traceIndexEntrySize. Transactions without
+/// records (e.g. filtered out) have an entry with length 0 and no block. An
+/// entry whose sequence number does not match its position (e.g. zeroes) was
+/// never written, as the records of the transaction were dropped.
+constexpr char traceDataMagic[8] = { 'H', 'E', 'R', 'A', 'T', 'R', 'C', '1' };
+constexpr char traceIndexMagic[8] = { 'H', 'E', 'R', 'A', 'I', 'D', 'X', '1' };
+constexpr size_t traceIndexEntrySize = 24;
+constexpr uint8_t traceAccountFlag = 0x80;
+
+void putVarint(std::string & out, uint64_t value);
+bool getVarint(uint8_t const*& in, uint8_t const* end, uint64_t & value);
+
+/// Encodes the records of a single transaction into a block payload.
+class TraceBlockEncoder {
+public:
+  bool isOpen() const { return m_open; }
+  uint64_t sequence() const { return m_sequence; }
+  bool empty() const { return m_empty; }
+
+  void begin(uint64_t sequence, evmc_address const& recipient);
+  void add(TraceRecord const& record);
+  /// @returns the payload and closes the block.
+  std::string finish();
+
+private:
+  void putAccount(evmc_address const& account);
+  void putWord(evmc_bytes32 const& word);
+
+  bool m_open = false;
+  bool m_empty = true;
+  uint64_t m_sequence = 0;
+  std::string m_payload;
+  evmc_address m_lastAccount{};
+  std::unordered_map<std::string, uint64_t> m_accounts;
+  std::unordered_map<std::string, uint64_t> m_words;
+};
+
+/// Decodes a block payload written by TraceBlockEncoder.
+class TraceBlockDecoder {
+public:
+  TraceBlockDecoder(uint8_t const* payload, size_t length);
+
+  /// @returns false if the header of the block is malformed.
+  bool begin(uint64_t & sequence, evmc_address & recipient);
+  /// @returns false at the end of the block or if it is malformed.
+  bool next(TraceRecord & record);
+  bool malformed() const { return m_malformed; }
+
+private:
+  bool getAccount(evmc_address & account);
+  bool getWord(evmc_bytes32 & word);
+
+  uint8_t const* m_in;
+  uint8_t const* m_end;
+  bool m_malformed = false;
+  evmc_address m_lastAccount{};
+  std::vector<evmc_address> m_accounts;
+  std::vector<evmc_bytes32> m_words;
+};
+
+}
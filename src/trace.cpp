@@ -0,0 +1,501 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "debugging.h"
+#include "shared-mutex.h"
+#include "trace.h"
+
+using namespace std;
+
+namespace hera {
+
+namespace detail {
+atomic<bool> traceActive{false};
+}
+
+namespace {
+
+// Number of records buffered per thread. Must be a power of two.
+constexpr size_t ringCapacity = 1024;
+
+// How often the writer looks at the buffers when it is not woken up.
+constexpr chrono::milliseconds writerInterval{5};
+
+// Slots of a ring only used by transaction delimiters, so that the blocks of the
+// binary trace stay intact while state access records are dropped.
+constexpr size_t delimiterSlots = 2;
+
+// How long a delimiter waits for a slot before it is dropped as well.
+constexpr chrono::milliseconds delimiterWait{50};
+
+// Single producer (the owning thread), single consumer (the writer thread) queue.
+struct TraceRing {
+  array<TraceRecord, ringCapacity> records;
+  atomic<size_t> head{0};
+  atomic<size_t> tail{0};
+  // Set when the owning thread has exited.
+  atomic<bool> abandoned{false};
+
+  // Only used by the writer thread: the transaction being collected.
+  TraceBlockEncoder block;
+  // Set if the records did not start with TransactionBegin.
+  bool implicitBlock = false;
+};
+
+void putLE64(string & out, uint64_t value)
+{
+  for (unsigned i = 0; i < 8; ++i)
+    out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+// @returns the size of the file, after writing @magic if it is empty.
+uint64_t prepareFile(FILE* file, char const (&magic)[8])
+{
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  if (size > 0)
+    return static_cast<uint64_t>(size);
+  fwrite(magic, 1, sizeof(magic), file);
+  return sizeof(magic);
+}
+
+// Opens the index at @path for writing entries in place.
+// @returns the descriptor and the number of entries in it, or -1.
+int openIndex(string const& path, uint64_t & entries)
+{
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return -1;
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    return -1;
+  }
+  uint64_t size = static_cast<uint64_t>(st.st_size);
+  if (size < sizeof(traceIndexMagic)) {
+    if (pwrite(fd, traceIndexMagic, sizeof(traceIndexMagic), 0) != static_cast<ssize_t>(sizeof(traceIndexMagic))) {
+      ::close(fd);
+      return -1;
+    }
+    size = sizeof(traceIndexMagic);
+  }
+  entries = (size - sizeof(traceIndexMagic)) / traceIndexEntrySize;
+  return fd;
+}
+
+class TraceSink {
+public:
+  ~TraceSink() { close(); }
+
+  bool setFormat(TraceFormat format)
+  {
+    lock_guard<mutex> controlLock(m_controlMutex);
+    if (m_writer.joinable() && m_format != format)
+      return false;
+    m_nextFormat = format;
+    return true;
+  }
+
+  bool open(string const& path)
+  {
+    lock_guard<mutex> controlLock(m_controlMutex);
+    stopWriter();
+
+    if (path.empty())
+      return true;
+
+    FILE* file = fopen(path.c_str(), "ab");
+    if (!file)
+      return false;
+    int indexFd = -1;
+    if (m_nextFormat == TraceFormat::Binary) {
+      uint64_t entries = 0;
+      indexFd = openIndex(path + ".idx", entries);
+      if (indexFd < 0) {
+        fclose(file);
+        return false;
+      }
+      m_dataSize = prepareFile(file, traceDataMagic);
+      // Sequence numbers continue the index, also when appending to the trace of another process.
+      m_transactionCounter.store(entries, memory_order_relaxed);
+    }
+
+    // Records queued before the trace was reopened belong to the previous file.
+    {
+      lock_guard<mutex> lock(m_mutex);
+      for (auto const& ring: m_rings) {
+        ring->tail.store(ring->head.load(memory_order_acquire), memory_order_release);
+        ring->block.finish();
+        ring->implicitBlock = false;
+      }
+      m_format = m_nextFormat;
+      m_file = file;
+      m_indexFd = indexFd;
+      m_stop = false;
+    }
+    m_writer = thread(&TraceSink::writerLoop, this);
+    detail::traceActive.store(true, memory_order_release);
+    HERA_DEBUG << "Tracing state accesses to " << path << "\n";
+    return true;
+  }
+
+  void close()
+  {
+    lock_guard<mutex> controlLock(m_controlMutex);
+    stopWriter();
+  }
+
+  void setAddressFilter(vector<evmc_address> addresses)
+  {
+    lock_guard<SharedMutex> lock(m_filterMutex);
+    m_addresses = move(addresses);
+  }
+
+  void setSampleRate(uint64_t rate)
+  {
+    m_sampleRate.store(max<uint64_t>(rate, 1), memory_order_relaxed);
+  }
+
+  bool select(evmc_address const& destination)
+  {
+    {
+      SharedLock lock(m_filterMutex);
+      if (!m_addresses.empty()) {
+        auto match = [&](evmc_address const& address) {
+          return memcmp(address.bytes, destination.bytes, sizeof(address.bytes)) == 0;
+        };
+        if (none_of(m_addresses.begin(), m_addresses.end(), match))
+          return false;
+      }
+    }
+    uint64_t rate = m_sampleRate.load(memory_order_relaxed);
+    return rate == 1 || (m_sampleCounter.fetch_add(1, memory_order_relaxed) % rate) == 0;
+  }
+
+  uint64_t nextTransaction()
+  {
+    return m_transactionCounter.fetch_add(1, memory_order_relaxed);
+  }
+
+  // Never stalls the execution on the writer: if the ring is full, the record
+  // is dropped and counted. Only transaction delimiters wait, for a bounded time.
+  void record(TraceRecord const& record)
+  {
+    TraceRing& ring = localRing();
+    bool delimiter = record.event == TraceEvent::TransactionBegin || record.event == TraceEvent::TransactionEnd;
+    size_t limit = delimiter ? ringCapacity : ringCapacity - delimiterSlots;
+    size_t head = ring.head.load(memory_order_relaxed);
+    if (head - ring.tail.load(memory_order_acquire) >= limit) {
+      m_wakeup.notify_one();
+      if (!delimiter || !waitForSpace(ring, head, limit)) {
+        m_dropped.fetch_add(1, memory_order_relaxed);
+        return;
+      }
+    }
+    ring.records[head & (ringCapacity - 1)] = record;
+    ring.head.store(head + 1, memory_order_release);
+  }
+
+  uint64_t dropped() const
+  {
+    return m_dropped.load(memory_order_relaxed);
+  }
+
+private:
+  bool waitForSpace(TraceRing& ring, size_t head, size_t limit)
+  {
+    unique_lock<mutex> lock(m_spaceMutex);
+    return m_space.wait_for(lock, delimiterWait, [&]{
+      // Never wait for a writer which is not running.
+      return !detail::traceActive.load(memory_order_acquire) ||
+        head - ring.tail.load(memory_order_acquire) < limit;
+    }) && detail::traceActive.load(memory_order_acquire);
+  }
+
+  // Owned by the thread, keeps the ring alive until the writer has drained it.
+  struct LocalRing {
+    shared_ptr<TraceRing> ring;
+    ~LocalRing() {
+      if (ring)
+        ring->abandoned.store(true, memory_order_release);
+    }
+  };
+
+  TraceRing& localRing()
+  {
+    static thread_local LocalRing local;
+    if (!local.ring) {
+      local.ring = make_shared<TraceRing>();
+      lock_guard<mutex> lock(m_mutex);
+      m_rings.push_back(local.ring);
+    }
+    return *local.ring;
+  }
+
+  void stopWriter()
+  {
+    detail::traceActive.store(false, memory_order_release);
+    {
+      lock_guard<mutex> lock(m_spaceMutex);
+      m_space.notify_all();
+    }
+    if (!m_writer.joinable())
+      return;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wakeup.notify_one();
+    m_writer.join();
+    fclose(m_file);
+    m_file = nullptr;
+    if (m_indexFd >= 0) {
+      ::close(m_indexFd);
+      m_indexFd = -1;
+    }
+  }
+
+  void writerLoop()
+  {
+    vector<shared_ptr<TraceRing>> rings;
+    bool stop = false;
+    while (!stop) {
+      {
+        unique_lock<mutex> lock(m_mutex);
+        m_wakeup.wait_for(lock, writerInterval, [&]{ return m_stop; });
+        stop = m_stop;
+        // Forget the rings of exited threads once they are drained.
+        m_rings.erase(remove_if(m_rings.begin(), m_rings.end(), [](shared_ptr<TraceRing> const& ring) {
+          return ring->abandoned.load(memory_order_acquire) &&
+            ring->head.load(memory_order_acquire) == ring->tail.load(memory_order_relaxed) &&
+            !ring->block.isOpen();
+        }), m_rings.end());
+        rings = m_rings;
+      }
+
+      bool written = false;
+      for (auto const& ring: rings) {
+        written |= drain(*ring);
+        // Unfinished transactions are written out when the trace is closed or their thread is gone.
+        if (ring->block.isOpen() && (ring->implicitBlock || stop || ring->abandoned.load(memory_order_acquire)))
+          written |= writeBlock(*ring);
+      }
+      if (written)
+        fflush(m_file);
+    }
+  }
+
+  bool drain(TraceRing& ring)
+  {
+    size_t tail = ring.tail.load(memory_order_relaxed);
+    size_t head = ring.head.load(memory_order_acquire);
+    if (tail == head)
+      return false;
+    bool written = false;
+    for (; tail != head; ++tail) {
+      TraceRecord const& record = ring.records[tail & (ringCapacity - 1)];
+      if (m_format == TraceFormat::Text)
+        written |= writeText(record);
+      else
+        written |= addToBlock(ring, record);
+      // Release each slot as soon as possible so that the producer can continue.
+      ring.tail.store(tail + 1, memory_order_release);
+    }
+    {
+      lock_guard<mutex> lock(m_spaceMutex);
+      m_space.notify_all();
+    }
+    return written;
+  }
+
+  bool writeText(TraceRecord const& record)
+  {
+    char line[traceMaxLineLength];
+    size_t length = formatTraceRecord(record, line);
+    fwrite(line, 1, length, m_file);
+    return length > 0;
+  }
+
+  bool addToBlock(TraceRing& ring, TraceRecord const& record)
+  {
+    bool written = false;
+    switch (record.event) {
+    case TraceEvent::TransactionBegin:
+      if (ring.block.isOpen())
+        written = writeBlock(ring);
+      ring.block.begin(record.sequence, record.account);
+      ring.implicitBlock = false;
+      break;
+    case TraceEvent::TransactionEnd:
+      if (ring.block.isOpen())
+        written = writeBlock(ring);
+      break;
+    default:
+      // Tracing has started in the middle of a transaction, it is numbered here.
+      if (!ring.block.isOpen()) {
+        ring.block.begin(nextTransaction(), record.account);
+        ring.implicitBlock = true;
+      }
+      ring.block.add(record);
+      break;
+    }
+    return written;
+  }
+
+  bool writeBlock(TraceRing& ring)
+  {
+    bool empty = ring.block.empty();
+    uint64_t sequence = ring.block.sequence();
+    string payload = ring.block.finish();
+    ring.implicitBlock = false;
+
+    // Transactions which were filtered out or not sampled keep an empty entry,
+    // so that the entry of every transaction is at a fixed offset.
+    string entry;
+    putLE64(entry, sequence);
+    if (empty) {
+      putLE64(entry, m_dataSize);
+      putLE64(entry, 0);
+    } else {
+      string header;
+      putVarint(header, payload.size());
+      fwrite(header.data(), 1, header.size(), m_file);
+      fwrite(payload.data(), 1, payload.size(), m_file);
+      putLE64(entry, m_dataSize + header.size());
+      putLE64(entry, payload.size());
+      m_dataSize += header.size() + payload.size();
+    }
+    // Entries of concurrent transactions may be completed in any order.
+    off_t position = static_cast<off_t>(sizeof(traceIndexMagic) + sequence * traceIndexEntrySize);
+    if (pwrite(m_indexFd, entry.data(), entry.size(), position) != static_cast<ssize_t>(entry.size()))
+      HERA_DEBUG << "Failed to write the trace index entry of transaction " << sequence << "\n";
+    return !empty;
+  }
+
+  // Serializes setFormat(), open() and close().
+  mutex m_controlMutex;
+  TraceFormat m_nextFormat = TraceFormat::Text;
+
+  // Guards the fields below, except the files which belong to the writer while it runs.
+  mutex m_mutex;
+  condition_variable m_wakeup;
+  vector<shared_ptr<TraceRing>> m_rings;
+  bool m_stop = false;
+  TraceFormat m_format = TraceFormat::Text;
+  FILE* m_file = nullptr;
+  int m_indexFd = -1;
+  uint64_t m_dataSize = 0;
+  thread m_writer;
+
+  // Only taken exclusively to replace the filter, select() shares it.
+  SharedMutex m_filterMutex;
+  vector<evmc_address> m_addresses;
+
+  // Wakes up delimiters waiting for a slot, see record().
+  mutex m_spaceMutex;
+  condition_variable m_space;
+
+  atomic<uint64_t> m_dropped{0};
+  atomic<uint64_t> m_sampleRate{1};
+  atomic<uint64_t> m_sampleCounter{0};
+  atomic<uint64_t> m_transactionCounter{0};
+};
+
+TraceSink& sink()
+{
+  static TraceSink instance;
+  return instance;
+}
+
+}
+
+bool traceSetFormat(TraceFormat format)
+{
+  return sink().setFormat(format);
+}
+
+bool traceOpen(string const& path)
+{
+  return sink().open(path);
+}
+
+void traceClose()
+{
+  sink().close();
+}
+
+void traceSetAddressFilter(vector<evmc_address> addresses)
+{
+  sink().setAddressFilter(move(addresses));
+}
+
+void traceSetSampleRate(uint64_t rate)
+{
+  sink().setSampleRate(rate);
+}
+
+bool detail::traceSelect(evmc_address const& destination)
+{
+  return sink().select(destination);
+}
+
+void traceRecord(TraceRecord const& record)
+{
+  sink().record(record);
+}
+
+uint64_t traceDroppedRecords()
+{
+  return sink().dropped();
+}
+
+TraceTransaction::TraceTransaction(evmc_message const& msg)
+{
+  if (msg.depth != 0 || !detail::traceActive.load(memory_order_relaxed))
+    return;
+  m_active = true;
+  TraceRecord record{};
+  record.event = TraceEvent::TransactionBegin;
+  record.account = msg.destination;
+  record.sequence = sink().nextTransaction();
+  sink().record(record);
+}
+
+TraceTransaction::~TraceTransaction()
+{
+  if (!m_active)
+    return;
+  TraceRecord record{};
+  record.event = TraceEvent::TransactionEnd;
+  sink().record(record);
+}
+
+}
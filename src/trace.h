@@ -0,0 +1,103 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <evmc/evmc.h>
+
+#include "trace-format.h"
+
+namespace hera {
+
+/// The trace is process-wide: records from all threads are collected in
+/// per-thread ring buffers and written to a single file by a background thread.
+/// The text format is one line per event:
+///
+///   SSTORE: <path> <value>
+///   SLOAD: <path>
+///   LOG: <data offset> <data length> <topics...>
+///   CALL: / CALLCODE: / CALLDELEGATE: / CALLSTATIC:
+///   SUICIDE:
+///
+/// Each SSTORE and SUICIDE is written once; earlier versions wrote these lines twice.
+///
+/// Alternatively the binary format described in trace-format.h can be written.
+
+enum class TraceFormat {
+  Text,
+  Binary
+};
+
+/// Selects the format used by the next traceOpen(). The format of an open trace
+/// cannot be changed.
+/// @returns false if a trace is open in a different format.
+bool traceSetFormat(TraceFormat format);
+
+/// Starts writing the trace to @path (appending). An empty path stops tracing.
+/// @returns false if the file could not be opened.
+bool traceOpen(std::string const& path);
+
+/// Stops tracing, writing out all pending records.
+void traceClose();
+
+/// Only executions of these accounts are traced. An empty list traces every account.
+void traceSetAddressFilter(std::vector<evmc_address> addresses);
+
+/// Only one in every @rate executions is traced (1 traces every execution).
+void traceSetSampleRate(uint64_t rate);
+
+namespace detail {
+extern std::atomic<bool> traceActive;
+bool traceSelect(evmc_address const& destination);
+}
+
+/// Decides whether an execution of @destination is traced. Called once when
+/// the execution starts, so it is a single relaxed load if tracing is disabled.
+inline bool traceEnabledFor(evmc_address const& destination)
+{
+  if (!detail::traceActive.load(std::memory_order_relaxed))
+    return false;
+  return detail::traceSelect(destination);
+}
+
+/// Queues @record for writing. If the buffer of the calling thread is full, the
+/// record is dropped instead of waiting for the writer; only the delimiters of
+/// TraceTransaction wait, for a bounded time.
+void traceRecord(TraceRecord const& record);
+
+/// @returns the number of records dropped because a buffer was full.
+uint64_t traceDroppedRecords();
+
+/// Marks the records of a transaction (a top-level execution), so that the
+/// binary trace can keep them together in a block and index it.
+class TraceTransaction {
+public:
+  explicit TraceTransaction(evmc_message const& msg);
+  ~TraceTransaction();
+
+  TraceTransaction(TraceTransaction const&) = delete;
+  TraceTransaction& operator=(TraceTransaction const&) = delete;
+
+private:
+  bool m_active = false;
+};
+
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "debugging.h"
+#include "translator.h"
+
+using namespace std;
+
+namespace hera {
+
+namespace {
+
+// Responses larger than this are considered to be garbage.
+constexpr uint32_t maxResponseLength = 64 * 1024 * 1024;
+
+void writeLE32(uint8_t* out, uint32_t value)
+{
+  for (unsigned i = 0; i < 4; ++i)
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+
+uint32_t readLE32(uint8_t const* in)
+{
+  uint32_t ret = 0;
+  for (unsigned i = 0; i < 4; ++i)
+    ret |= uint32_t(in[i]) << (8 * i);
+  return ret;
+}
+
+int millisecondsUntil(chrono::steady_clock::time_point deadline)
+{
+  auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+  return left > 0 ? static_cast<int>(left) : 0;
+}
+
+bool setNonBlocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+// Writing to a pipe whose reader has died raises SIGPIPE, which would kill the
+// whole client. Block it on this thread while writing and discard it if raised.
+class SigpipeGuard {
+public:
+  SigpipeGuard() {
+    sigemptyset(&m_set);
+    sigaddset(&m_set, SIGPIPE);
+    sigset_t pending;
+    sigpending(&pending);
+    m_wasPending = sigismember(&pending, SIGPIPE) == 1;
+    pthread_sigmask(SIG_BLOCK, &m_set, &m_old);
+  }
+
+  ~SigpipeGuard() {
+    if (!m_wasPending) {
+      timespec zero{0, 0};
+      while (sigtimedwait(&m_set, nullptr, &zero) == SIGPIPE) {}
+    }
+    pthread_sigmask(SIG_SETMASK, &m_old, nullptr);
+  }
+
+private:
+  sigset_t m_set;
+  sigset_t m_old;
+  bool m_wasPending = false;
+};
+
+}
+
+TranslatorProcess::TranslatorProcess(string _command, chrono::milliseconds _timeout):
+  m_command(move(_command)),
+  m_timeout(_timeout)
+{}
+
+TranslatorProcess::~TranslatorProcess()
+{
+  stop();
+}
+
+vector<uint8_t> TranslatorProcess::translate(vector<uint8_t> const& input, bool evmTrace)
+{
+  HERA_DEBUG << "Calling translator process (input " << input.size() << " bytes)...\n";
+
+  vector<uint8_t> output;
+  Status status = request(input, evmTrace, output);
+  if (status == Status::Crashed) {
+    // The process may have died since the previous request, give it another chance.
+    HERA_DEBUG << "Translator process died, restarting\n";
+    status = request(input, evmTrace, output);
+  }
+
+  switch (status) {
+  case Status::Success:
+    HERA_DEBUG << "Translator process done (output " << output.size() << " bytes)\n";
+    return output;
+  case Status::Failure:
+    HERA_DEBUG << "Translator process failed: " << string(output.begin(), output.end()) << "\n";
+    break;
+  case Status::Crashed:
+    HERA_DEBUG << "Translator process crashed\n";
+    break;
+  case Status::TimedOut:
+    HERA_DEBUG << "Translator process timed out\n";
+    break;
+  }
+  return vector<uint8_t>();
+}
+
+TranslatorProcess::Status TranslatorProcess::request(vector<uint8_t> const& input, bool evmTrace, vector<uint8_t>& output)
+{
+  if (m_pid == -1 && !start())
+    return Status::Failure;
+
+  if (input.size() > numeric_limits<uint32_t>::max())
+    return Status::Failure;
+
+  auto deadline = chrono::steady_clock::now() + m_timeout;
+  Status status = Status::Success;
+
+  uint8_t header[5];
+  header[0] = evmTrace ? 1 : 0;
+  writeLE32(header + 1, static_cast<uint32_t>(input.size()));
+
+  if (
+    !writeAll(header, sizeof(header), deadline, status) ||
+    !writeAll(input.data(), input.size(), deadline, status) ||
+    !readAll(header, sizeof(header), deadline, status)
+  ) {
+    stop();
+    return status;
+  }
+
+  uint32_t length = readLE32(header + 1);
+  if (length > maxResponseLength) {
+    stop();
+    return Status::Crashed;
+  }
+
+  output.resize(length);
+  if (!readAll(output.data(), length, deadline, status)) {
+    stop();
+    return status;
+  }
+
+  return header[0] == 0 ? Status::Success : Status::Failure;
+}
+
+bool TranslatorProcess::start()
+{
+  // The pipes must not leak into processes forked by the client concurrently,
+  // so they are close-on-exec from the start. dup2() clears it in the child.
+  int toChild[2];
+  int fromChild[2];
+  if (pipe2(toChild, O_CLOEXEC) != 0)
+    return false;
+  if (pipe2(fromChild, O_CLOEXEC) != 0) {
+    close(toChild[0]);
+    close(toChild[1]);
+    return false;
+  }
+
+  // Only async-signal-safe calls are allowed in the child, prepare everything here.
+  char const* argv[] = { "/bin/sh", "-c", m_command.c_str(), nullptr };
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    for (int fd: { toChild[0], toChild[1], fromChild[0], fromChild[1] })
+      close(fd);
+    return false;
+  }
+
+  if (pid == 0) {
+    dup2(toChild[0], STDIN_FILENO);
+    dup2(fromChild[1], STDOUT_FILENO);
+    // dup2() leaves the flags alone if a pipe already is the standard stream.
+    fcntl(STDIN_FILENO, F_SETFD, 0);
+    fcntl(STDOUT_FILENO, F_SETFD, 0);
+    for (int fd: { toChild[0], toChild[1], fromChild[0], fromChild[1] })
+      if (fd != STDIN_FILENO && fd != STDOUT_FILENO)
+        close(fd);
+    execv(argv[0], const_cast<char* const*>(argv));
+    _exit(127);
+  }
+
+  close(toChild[0]);
+  close(fromChild[1]);
+  m_pid = pid;
+  m_toChild = toChild[1];
+  m_fromChild = fromChild[0];
+
+  if (!setNonBlocking(m_toChild) || !setNonBlocking(m_fromChild)) {
+    stop();
+    return false;
+  }
+
+  HERA_DEBUG << "Started translator process " << m_pid << ": " << m_command << "\n";
+  return true;
+}
+
+void TranslatorProcess::stop()
+{
+  if (m_toChild != -1)
+    close(m_toChild);
+  if (m_fromChild != -1)
+    close(m_fromChild);
+  m_toChild = -1;
+  m_fromChild = -1;
+
+  if (m_pid != -1) {
+    kill(m_pid, SIGKILL);
+    while (waitpid(m_pid, nullptr, 0) == -1 && errno == EINTR) {}
+    m_pid = -1;
+  }
+}
+
+bool TranslatorProcess::writeAll(uint8_t const* data, size_t length, chrono::steady_clock::time_point deadline, Status& status)
+{
+  SigpipeGuard guard;
+  while (length > 0) {
+    ssize_t ret = write(m_toChild, data, length);
+    if (ret > 0) {
+      data += ret;
+      length -= static_cast<size_t>(ret);
+      continue;
+    }
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pollfd pfd{m_toChild, POLLOUT, 0};
+      int timeout = millisecondsUntil(deadline);
+      if (timeout == 0 || (poll(&pfd, 1, timeout) == 0)) {
+        status = Status::TimedOut;
+        return false;
+      }
+      continue;
+    }
+    status = Status::Crashed;
+    return false;
+  }
+  return true;
+}
+
+bool TranslatorProcess::readAll(uint8_t* data, size_t length, chrono::steady_clock::time_point deadline, Status& status)
+{
+  while (length > 0) {
+    ssize_t ret = read(m_fromChild, data, length);
+    if (ret > 0) {
+      data += ret;
+      length -= static_cast<size_t>(ret);
+      continue;
+    }
+    if (ret == -1 && errno == EINTR)
+      continue;
+    if (ret == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      pollfd pfd{m_fromChild, POLLIN, 0};
+      int timeout = millisecondsUntil(deadline);
+      if (timeout == 0 || (poll(&pfd, 1, timeout) == 0)) {
+        status = Status::TimedOut;
+        return false;
+      }
+      continue;
+    }
+    // End of file: the process has exited.
+    status = Status::Crashed;
+    return false;
+  }
+  return true;
+}
+
+}
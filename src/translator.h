@@ -0,0 +1,75 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace hera {
+
+/// A long-lived external translator (e.g. evm2wasm.js) talking over pipes.
+///
+/// The command is started through `/bin/sh -c` and receives requests on its
+/// standard input and sends responses on its standard output. All integers
+/// are little-endian.
+///
+///   request:  u8 flags (bit 0: tracing), u32 length, EVM1 bytecode
+///   response: u8 status (0: success), u32 length, WebAssembly binary
+///             (or an error message if the status is non-zero)
+///
+/// The process is started on first use and restarted if it dies. If it does
+/// not answer within the timeout it is killed. Not thread-safe.
+class TranslatorProcess {
+public:
+  TranslatorProcess(std::string _command, std::chrono::milliseconds _timeout);
+  ~TranslatorProcess();
+
+  TranslatorProcess(TranslatorProcess const&) = delete;
+  TranslatorProcess& operator=(TranslatorProcess const&) = delete;
+
+  /// Translates @input.
+  /// @returns the compiled output or empty output otherwise.
+  std::vector<uint8_t> translate(std::vector<uint8_t> const& input, bool evmTrace);
+
+private:
+  enum class Status {
+    Success,
+    Failure,
+    Crashed,
+    TimedOut
+  };
+
+  Status request(std::vector<uint8_t> const& input, bool evmTrace, std::vector<uint8_t>& output);
+
+  bool start();
+  void stop();
+
+  bool writeAll(uint8_t const* data, size_t length, std::chrono::steady_clock::time_point deadline, Status& status);
+  bool readAll(uint8_t* data, size_t length, std::chrono::steady_clock::time_point deadline, Status& status);
+
+  std::string m_command;
+  std::chrono::milliseconds m_timeout;
+
+  pid_t m_pid = -1;
+  int m_toChild = -1;
+  int m_fromChild = -1;
+};
+
+}
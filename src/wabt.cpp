@@ -14,6 +14,11 @@
  * limitations under the License.
  */
 
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 
@@ -35,29 +40,92 @@
 #include "debugging.h"
 #include "eei.h"
 #include "exceptions.h"
+#include "idle-budget.h"
 
 using namespace std;
 
 namespace hera {
 
-class WabtEthereumInterface : EthereumInterface, public wabt::interp::HostImportDelegate {
+class WabtEthereumInterface;
+
+typedef wabt::interp::Result (*WabtHostCallback)(
+  const wabt::interp::HostFunc* func,
+  const wabt::interp::FuncSignature* sig,
+  wabt::Index num_args,
+  wabt::interp::TypedValue* args,
+  wabt::Index num_results,
+  wabt::interp::TypedValue* out_results,
+  void* user_data
+);
+
+// The signature of a host function and the callback implementing it.
+struct WabtHostFunction {
+  wabt::TypeVector params;
+  wabt::TypeVector results;
+  WabtHostCallback callback;
+};
+
+class WabtHostImports;
+
+// A loaded copy of a contract. It is reset to its state after loading between
+// executions, which avoids reading the contract again. The executor, and with
+// it the value and call stacks, is kept along with it.
+struct WabtEnvironment {
+  explicit WabtEnvironment(vector<uint8_t> const& code);
+
+  WabtEnvironment(WabtEnvironment const&) = delete;
+  WabtEnvironment& operator=(WabtEnvironment const&) = delete;
+
+  /// Restores the memory and the globals as they were after loading.
+  void reset();
+
+  /// Rough estimate of the memory kept while idle, for reserveIdleState().
+  size_t idleCost() const { return m_idleCost; }
+
+  // This is the wasm state
+  wabt::interp::Environment env;
+  // Owned by the host module in env.
+  WabtHostImports* hostImports = nullptr;
+  wabt::interp::Export* mainFunction = nullptr;
+  unique_ptr<wabt::interp::Executor> executor;
+
+private:
+  wabt::interp::Memory m_initialMemory;
+  vector<wabt::interp::TypedValue> m_initialGlobals;
+  size_t m_idleCost = 0;
+};
+
+// A module with its code checked to load.
+struct WabtModule : PreparedModule {
+  vector<uint8_t> code;
+
+  // Loaded environments not in use by an execution, reserved by reserveIdleState().
+  mutable mutex environmentsMutex;
+  mutable vector<unique_ptr<WabtEnvironment>> idleEnvironments;
+
+  ~WabtModule() noexcept override
+  {
+    for (auto const& environment: idleEnvironments)
+      releaseIdleState(environment->idleCost());
+  }
+
+  // Only a rough estimate of the loaded representation.
+  size_t memoryCost() const override { return code.size() * 8; }
+};
+
+// Resolves the imports of the "ethereum" host module. The host functions
+// get the delegate as their user data and call the interface of the
+// execution in progress.
+class WabtHostImports : public wabt::interp::HostImportDelegate {
 public:
-  explicit WabtEthereumInterface(
-    evmc_context* _context,
-    vector<uint8_t> const& _code,
-    evmc_message const& _msg,
-    ExecutionResult & _result,
-    bool _meterGas
-  ):
-    EthereumInterface(_context, _code, _msg, _result, _meterGas)
-  {}
+  void bind(WabtEthereumInterface* _interface) { m_interface = _interface; }
 
-  // TODO: improve this design...
-  void setWasmMemory(wabt::interp::Memory* _wasmMemory) {
-    m_wasmMemory = _wasmMemory;
+  static WabtEthereumInterface* boundInterface(void* user_data) {
+    WabtEthereumInterface* interface = reinterpret_cast<WabtHostImports*>(user_data)->m_interface;
+    heraAssert(interface, "Host function called outside of an execution.");
+    return interface;
   }
 
-protected:
   wabt::Result ImportFunc(
     wabt::interp::FuncImport* import,
     wabt::interp::Func* func,
@@ -83,180 +151,229 @@ protected:
     const ErrorCallback& callback
   ) override;
 
-  static wabt::interp::Result wabtUseGas(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
-    wabt::interp::TypedValue* args,
-    wabt::Index num_results,
-    wabt::interp::TypedValue* out_results,
-    void* user_data
-  );
+private:
+  WabtEthereumInterface* m_interface = nullptr;
+};
 
-  static wabt::interp::Result wabtGetGasLeft(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
-    wabt::interp::TypedValue* args,
-    wabt::Index num_results,
-    wabt::interp::TypedValue* out_results,
-    void* user_data
-  );
+class WabtEthereumInterface : public EthereumInterface {
+public:
+  explicit WabtEthereumInterface(
+    evmc_context* _context,
+    vector<uint8_t> const& _code,
+    evmc_message const& _msg,
+    ExecutionResult & _result,
+    bool _meterGas
+  ):
+    EthereumInterface(_context, _code, _msg, _result, _meterGas)
+  {}
 
-  static wabt::interp::Result wabtStorageStore(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
-    wabt::interp::TypedValue* args,
-    wabt::Index num_results,
-    wabt::interp::TypedValue* out_results,
-    void* user_data
-  );
+  void setWasmMemory(wabt::interp::Memory* _wasmMemory) {
+    m_wasmMemory = _wasmMemory;
+  }
 
-  static wabt::interp::Result wabtStorageLoad(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
-    wabt::interp::TypedValue* args,
-    wabt::Index num_results,
-    wabt::interp::TypedValue* out_results,
-    void* user_data
-  );
+  // Resolves an import of the "ethereum" host module. Returns nullptr for unknown names.
+  static WabtHostFunction const* hostFunction(string const& name);
 
-  static wabt::interp::Result wabtFinish(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
-    wabt::interp::TypedValue* args,
-    wabt::Index num_results,
-    wabt::interp::TypedValue* out_results,
-    void* user_data
-  );
+  // Whether finish, revert or selfDestruct was called.
+  bool ended() const { return m_ended; }
 
-  static wabt::interp::Result wabtRevert(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
-    wabt::interp::TypedValue* args,
-    wabt::Index num_results,
-    wabt::interp::TypedValue* out_results,
-    void* user_data
-  );
+private:
+  // The call variants share eeiCall(), only the plain call and callCode take a value.
+  uint32_t wabtCall(int64_t gas, uint32_t addressOffset, uint32_t valueOffset, uint32_t dataOffset, uint32_t dataLength) {
+    return eeiCall(EEICallKind::Call, gas, addressOffset, valueOffset, dataOffset, dataLength);
+  }
+  uint32_t wabtCallCode(int64_t gas, uint32_t addressOffset, uint32_t valueOffset, uint32_t dataOffset, uint32_t dataLength) {
+    return eeiCall(EEICallKind::CallCode, gas, addressOffset, valueOffset, dataOffset, dataLength);
+  }
+  uint32_t wabtCallDelegate(int64_t gas, uint32_t addressOffset, uint32_t dataOffset, uint32_t dataLength) {
+    return eeiCall(EEICallKind::CallDelegate, gas, addressOffset, 0, dataOffset, dataLength);
+  }
+  uint32_t wabtCallStatic(int64_t gas, uint32_t addressOffset, uint32_t dataOffset, uint32_t dataLength) {
+    return eeiCall(EEICallKind::CallStatic, gas, addressOffset, 0, dataOffset, dataLength);
+  }
 
-  static wabt::interp::Result wabtGetCallDataSize(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
-    wabt::interp::TypedValue* args,
-    wabt::Index num_results,
-    wabt::interp::TypedValue* out_results,
-    void* user_data
-  );
+  // These assume that m_wasmMemory was set prior to execution.
+  size_t memorySize() const override { return m_wasmMemory->data.size(); }
+  uint8_t* memoryData() override { return reinterpret_cast<uint8_t*>(m_wasmMemory->data.data()); }
 
-  static wabt::interp::Result wabtCallDataCopy(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
-    wabt::interp::TypedValue* args,
-    wabt::Index num_results,
-    wabt::interp::TypedValue* out_results,
-    void* user_data
-  );
+  // The host function returns and the trampoline stops the executor.
+  void endExecution() override { m_ended = true; }
+
+  wabt::interp::Memory* m_wasmMemory;
+  bool m_ended = false;
+};
+
+class WabtInstance : public WasmInstance {
+public:
+  explicit WabtInstance(shared_ptr<WabtModule const> _module);
+  ~WabtInstance() noexcept override;
+
+  ExecutionResult run(
+    evmc_context* context,
+    vector<uint8_t> const& state_code,
+    evmc_message const& msg,
+    bool meterInterfaceGas
+  ) override;
+
+private:
+  shared_ptr<WabtModule const> m_module;
+  unique_ptr<WabtEnvironment> m_environment;
+};
+
+namespace {
+
+template <size_t... I> struct Indices {};
+template <size_t N, size_t... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template <size_t... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+// Converts between the values of the interpreter and the types used by the EEI methods.
+template <typename T> struct WabtValue;
+
+template <> struct WabtValue<uint32_t> {
+  static wabt::Type type() { return wabt::Type::I32; }
+  static uint32_t get(wabt::interp::TypedValue const& value) { return value.value.i32; }
+  static void set(wabt::interp::TypedValue& out, uint32_t value) { out.type = type(); out.value.i32 = value; }
+};
+
+template <> struct WabtValue<uint64_t> {
+  static wabt::Type type() { return wabt::Type::I64; }
+  static uint64_t get(wabt::interp::TypedValue const& value) { return value.value.i64; }
+  static void set(wabt::interp::TypedValue& out, uint64_t value) { out.type = type(); out.value.i64 = value; }
+};
+
+template <> struct WabtValue<int64_t> {
+  static wabt::Type type() { return wabt::Type::I64; }
+  static int64_t get(wabt::interp::TypedValue const& value) { return static_cast<int64_t>(value.value.i64); }
+  static void set(wabt::interp::TypedValue& out, int64_t value) { out.type = type(); out.value.i64 = static_cast<uint64_t>(value); }
+};
+
+template <typename R> wabt::TypeVector wabtResultTypes() { return { WabtValue<R>::type() }; }
+template <> wabt::TypeVector wabtResultTypes<void>() { return {}; }
+
+// Calls @method on the interface of the execution in progress, with the
+// arguments converted from the types of its parameters.
+template <typename Method, Method method> struct WabtTrampoline;
 
-  static wabt::interp::Result wabtGetCallValue(
-    const wabt::interp::HostFunc* func,
-    const wabt::interp::FuncSignature* sig,
-    wabt::Index num_args,
+template <typename Class, typename R, typename... Args, R (Class::*method)(Args...)>
+struct WabtTrampoline<R (Class::*)(Args...), method> {
+  static WabtHostFunction hostFunction()
+  {
+    return WabtHostFunction{ { WabtValue<Args>::type()... }, wabtResultTypes<R>(), &call };
+  }
+
+  static wabt::interp::Result call(
+    const wabt::interp::HostFunc*,
+    const wabt::interp::FuncSignature*,
+    wabt::Index,
     wabt::interp::TypedValue* args,
-    wabt::Index num_results,
+    wabt::Index,
     wabt::interp::TypedValue* out_results,
     void* user_data
-  );
+  ) {
+    WabtEthereumInterface& interface = *WabtHostImports::boundInterface(user_data);
+    invoke(interface, args, out_results, typename MakeIndices<sizeof...(Args)>::type{}, is_void<R>{});
+    // Trapping is how a host function stops the executor, the execution itself succeeded.
+    if (interface.ended())
+      return wabt::interp::Result::TrapHostTrapped;
+    return wabt::interp::Result::Ok;
+  }
 
 private:
-  // These assume that m_wasmMemory was set prior to execution.
-  size_t memorySize() const override { return m_wasmMemory->data.size(); }
-  void memorySet(size_t offset, uint8_t value) override { m_wasmMemory->data[offset] = static_cast<char>(value); }
-  uint8_t memoryGet(size_t offset) override { return static_cast<uint8_t>(m_wasmMemory->data[offset]); }
+  template <size_t... I>
+  static void invoke(Class& interface, wabt::interp::TypedValue* args, wabt::interp::TypedValue*, Indices<I...>, true_type)
+  {
+    (void)args;
+    (interface.*method)(WabtValue<Args>::get(args[I])...);
+  }
 
-  wabt::interp::Memory* m_wasmMemory;
+  template <size_t... I>
+  static void invoke(Class& interface, wabt::interp::TypedValue* args, wabt::interp::TypedValue* out_results, Indices<I...>, false_type)
+  {
+    (void)args;
+    WabtValue<R>::set(out_results[0], (interface.*method)(WabtValue<Args>::get(args[I])...));
+  }
 };
 
+}
+
+#define HERA_WABT_HOST_FUNCTION(name, method) \
+  { name, WabtTrampoline<decltype(&WabtEthereumInterface::method), &WabtEthereumInterface::method>::hostFunction() }
+
+WabtHostFunction const* WabtEthereumInterface::hostFunction(string const& name)
+{
+  static const unordered_map<string, WabtHostFunction> functions{
+    HERA_WABT_HOST_FUNCTION("useGas", eeiUseGas),
+    HERA_WABT_HOST_FUNCTION("getGasLeft", eeiGetGasLeft),
+    HERA_WABT_HOST_FUNCTION("getAddress", eeiGetAddress),
+    HERA_WABT_HOST_FUNCTION("getExternalBalance", eeiGetExternalBalance),
+    HERA_WABT_HOST_FUNCTION("getBlockHash", eeiGetBlockHash),
+    HERA_WABT_HOST_FUNCTION("getCallDataSize", eeiGetCallDataSize),
+    HERA_WABT_HOST_FUNCTION("callDataCopy", eeiCallDataCopy),
+    HERA_WABT_HOST_FUNCTION("getCaller", eeiGetCaller),
+    HERA_WABT_HOST_FUNCTION("getCallValue", eeiGetCallValue),
+    HERA_WABT_HOST_FUNCTION("codeCopy", eeiCodeCopy),
+    HERA_WABT_HOST_FUNCTION("getCodeSize", eeiGetCodeSize),
+    HERA_WABT_HOST_FUNCTION("externalCodeCopy", eeiExternalCodeCopy),
+    HERA_WABT_HOST_FUNCTION("getExternalCodeSize", eeiGetExternalCodeSize),
+    HERA_WABT_HOST_FUNCTION("getBlockCoinbase", eeiGetBlockCoinbase),
+    HERA_WABT_HOST_FUNCTION("getBlockDifficulty", eeiGetBlockDifficulty),
+    HERA_WABT_HOST_FUNCTION("getBlockGasLimit", eeiGetBlockGasLimit),
+    HERA_WABT_HOST_FUNCTION("getTxGasPrice", eeiGetTxGasPrice),
+    HERA_WABT_HOST_FUNCTION("log", eeiLog),
+    HERA_WABT_HOST_FUNCTION("getBlockNumber", eeiGetBlockNumber),
+    HERA_WABT_HOST_FUNCTION("getBlockTimestamp", eeiGetBlockTimestamp),
+    HERA_WABT_HOST_FUNCTION("getTxOrigin", eeiGetTxOrigin),
+    HERA_WABT_HOST_FUNCTION("storageStore", eeiStorageStore),
+    HERA_WABT_HOST_FUNCTION("storageLoad", eeiStorageLoad),
+    HERA_WABT_HOST_FUNCTION("finish", eeiFinish),
+    HERA_WABT_HOST_FUNCTION("revert", eeiRevert),
+    HERA_WABT_HOST_FUNCTION("getReturnDataSize", eeiGetReturnDataSize),
+    HERA_WABT_HOST_FUNCTION("returnDataCopy", eeiReturnDataCopy),
+    HERA_WABT_HOST_FUNCTION("call", wabtCall),
+    HERA_WABT_HOST_FUNCTION("callCode", wabtCallCode),
+    HERA_WABT_HOST_FUNCTION("callDelegate", wabtCallDelegate),
+    HERA_WABT_HOST_FUNCTION("callStatic", wabtCallStatic),
+    HERA_WABT_HOST_FUNCTION("create", eeiCreate),
+    HERA_WABT_HOST_FUNCTION("create2", eeiCreate2),
+    HERA_WABT_HOST_FUNCTION("selfDestruct", eeiSelfDestruct),
+    HERA_WABT_HOST_FUNCTION("getExternalCodeHash", eeiGetExternalCodeHash),
+    HERA_WABT_HOST_FUNCTION("getChainID", eeiGetChainID),
+    HERA_WABT_HOST_FUNCTION("getSelfBalance", eeiGetSelfBalance),
+    HERA_WABT_HOST_FUNCTION("getBasefee", eeiGetBasefee),
+  };
+
+  auto it = functions.find(name);
+  return (it != functions.end()) ? &it->second : nullptr;
+}
+
+#undef HERA_WABT_HOST_FUNCTION
+
 unique_ptr<WasmEngine> WabtEngine::create()
 {
   return unique_ptr<WasmEngine>{new WabtEngine};
 }
 
-wabt::Result WabtEthereumInterface::ImportFunc(
+wabt::Result WabtHostImports::ImportFunc(
   wabt::interp::FuncImport* import,
   wabt::interp::Func* func,
   wabt::interp::FuncSignature* func_sig,
   const ErrorCallback& callback
 ) {
-  (void)import;
-  (void)func;
   (void)callback;
   HERA_DEBUG << "Importing " << import->field_name << "\n";
+  WabtHostFunction const* function = WabtEthereumInterface::hostFunction(import->field_name);
+  if (!function)
+    return wabt::Result::Error;
+  if (func_sig->param_types != function->params || func_sig->result_types != function->results)
+    return wabt::Result::Error;
+
   wabt::interp::HostFunc *hostFunc = reinterpret_cast<wabt::interp::HostFunc*>(func);
-  if (import->field_name == "useGas") {
-    if (func_sig->param_types.size() != 1 || func_sig->result_types.size() != 0)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtUseGas;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  } else if (import->field_name == "getGasLeft") {
-    if (func_sig->param_types.size() != 0 || func_sig->result_types.size() != 1)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtGetGasLeft;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  } else if (import->field_name == "storageStore") {
-    if (func_sig->param_types.size() != 2 || func_sig->result_types.size() != 0)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtStorageStore;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  } else if (import->field_name == "storageLoad") {
-    if (func_sig->param_types.size() != 2 || func_sig->result_types.size() != 0)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtStorageLoad;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  } else if (import->field_name == "finish") {
-    if (func_sig->param_types.size() != 2 || func_sig->result_types.size() != 0)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtFinish;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  } else if (import->field_name == "revert") {
-    if (func_sig->param_types.size() != 2 || func_sig->result_types.size() != 0)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtRevert;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  } else if (import->field_name == "getCallDataSize") {
-    if (func_sig->param_types.size() != 0 || func_sig->result_types.size() != 1)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtGetCallDataSize;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  } else if (import->field_name == "callDataCopy") {
-    if (func_sig->param_types.size() != 3 || func_sig->result_types.size() != 0)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtCallDataCopy;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  } else if (import->field_name == "getCallValue") {
-    if (func_sig->param_types.size() != 1 || func_sig->result_types.size() != 0)
-      return wabt::Result::Error;
-    hostFunc->callback = wabtGetCallValue;
-    hostFunc->user_data = this;
-    return wabt::Result::Ok;
-  }
-  return wabt::Result::Error;
+  hostFunc->callback = function->callback;
+  hostFunc->user_data = this;
+  return wabt::Result::Ok;
 }
 
-wabt::Result WabtEthereumInterface::ImportMemory(
+wabt::Result WabtHostImports::ImportMemory(
   wabt::interp::MemoryImport* import,
   wabt::interp::Memory* mem,
   const ErrorCallback& callback
@@ -267,7 +384,7 @@ wabt::Result WabtEthereumInterface::ImportMemory(
   return wabt::Result::Error;
 }
 
-wabt::Result WabtEthereumInterface::ImportGlobal(
+wabt::Result WabtHostImports::ImportGlobal(
   wabt::interp::GlobalImport* import,
   wabt::interp::Global* global,
   const ErrorCallback& callback
@@ -278,7 +395,7 @@ wabt::Result WabtEthereumInterface::ImportGlobal(
   return wabt::Result::Error;
 }
 
-wabt::Result WabtEthereumInterface::ImportTable(
+wabt::Result WabtHostImports::ImportTable(
   wabt::interp::TableImport* import,
   wabt::interp::Table* table,
   const ErrorCallback& callback
@@ -289,250 +406,42 @@ wabt::Result WabtEthereumInterface::ImportTable(
   return wabt::Result::Error;
 }
 
-wabt::interp::Result WabtEthereumInterface::wabtUseGas(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)sig;
-  (void)num_args;
-  (void)num_results;
-  (void)out_results;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
-
-  int64_t gas = static_cast<int64_t>(args[0].value.i64);
-
-  // FIXME: handle host trap here
-  interface->eeiUseGas(gas);
-
-  return wabt::interp::Result::Ok;
-}
-
-wabt::interp::Result WabtEthereumInterface::wabtGetGasLeft(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)num_results;
-  (void)args;
-  (void)num_args;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
-
-  out_results[0].type = sig->result_types[0];
-  out_results[0].value.i64 = static_cast<uint64_t>(interface->eeiGetGasLeft());
-
-  return wabt::interp::Result::Ok;
-}
-
-wabt::interp::Result WabtEthereumInterface::wabtStorageStore(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)sig;
-  (void)num_args;
-  (void)num_results;
-  (void)out_results;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
-
-  uint32_t pathOffset = args[0].value.i32;
-  uint32_t valueOffset = args[1].value.i32;
-  
-  interface->eeiStorageStore(pathOffset, valueOffset);
-
-  return wabt::interp::Result::Ok;
-}
-
-wabt::interp::Result WabtEthereumInterface::wabtStorageLoad(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)sig;
-  (void)num_args;
-  (void)num_results;
-  (void)out_results;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
-
-  uint32_t pathOffset = args[0].value.i32;
-  uint32_t valueOffset = args[1].value.i32;
-  
-  interface->eeiStorageLoad(pathOffset, valueOffset);
-
-  return wabt::interp::Result::Ok;
-}
-
-wabt::interp::Result WabtEthereumInterface::wabtFinish(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)sig;
-  (void)num_args;
-  (void)num_results;
-  (void)out_results;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
-
-  uint32_t offset = args[0].value.i32;
-  uint32_t length = args[1].value.i32;
-
-  // FIXME: handle host trap here
-  interface->eeiFinish(offset, length);
-
-  return wabt::interp::Result::Ok;
-}
-
-wabt::interp::Result WabtEthereumInterface::wabtRevert(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)sig;
-  (void)num_args;
-  (void)num_results;
-  (void)out_results;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
-
-  uint32_t offset = args[0].value.i32;
-  uint32_t length = args[1].value.i32;
-
-  // FIXME: handle host trap here
-  interface->eeiRevert(offset, length);
-
-  return wabt::interp::Result::Ok;
-}
-
-wabt::interp::Result WabtEthereumInterface::wabtGetCallDataSize(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)num_results;
-  (void)args;
-  (void)num_args;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
+namespace {
 
-  out_results[0].type = sig->result_types[0];
-  out_results[0].value.i32 = interface->eeiGetCallDataSize();
+// Idle environments kept for each module, more, or those beyond the budget of
+// reserveIdleState(), are released.
+constexpr size_t maxIdleEnvironments = 8;
 
-  return wabt::interp::Result::Ok;
 }
 
-wabt::interp::Result WabtEthereumInterface::wabtCallDataCopy(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)sig;
-  (void)num_args;
-  (void)num_results;
-  (void)out_results;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
-
-  uint32_t resultOffset = args[0].value.i32;
-  uint32_t dataOffset = args[1].value.i32;
-  uint32_t length = args[2].value.i32;
+shared_ptr<PreparedModule const> WabtEngine::prepare(vector<uint8_t> const& code)
+{
+  auto module = make_shared<WabtModule>();
+  module->code = code;
 
-  interface->eeiCallDataCopy(resultOffset, dataOffset, length);
+  // Load it once to validate it, and keep it for the first execution.
+  unique_ptr<WabtEnvironment> environment{new WabtEnvironment(module->code)};
+  if (reserveIdleState(environment->idleCost()))
+    module->idleEnvironments.push_back(move(environment));
 
-  return wabt::interp::Result::Ok;
+  return module;
 }
 
-wabt::interp::Result WabtEthereumInterface::wabtGetCallValue(
-  const wabt::interp::HostFunc* func,
-  const wabt::interp::FuncSignature* sig,
-  wabt::Index num_args,
-  wabt::interp::TypedValue* args,
-  wabt::Index num_results,
-  wabt::interp::TypedValue* out_results,
-  void* user_data
-) {
-  (void)func;
-  (void)sig;
-  (void)num_args;
-  (void)num_results;
-  (void)out_results;
-
-  WabtEthereumInterface *interface = reinterpret_cast<WabtEthereumInterface*>(user_data);
-
-  uint32_t resultOffset = args[0].value.i32;
-  
-  interface->eeiGetCallValue(resultOffset);
-
-  return wabt::interp::Result::Ok;
+unique_ptr<WasmInstance> WabtEngine::instantiate(shared_ptr<PreparedModule const> module)
+{
+  auto wabtModule = dynamic_pointer_cast<WabtModule const>(module);
+  heraAssert(wabtModule, "Module was not prepared by wabt.");
+  return unique_ptr<WasmInstance>{new WabtInstance(move(wabtModule))};
 }
 
-ExecutionResult WabtEngine::execute(
-  evmc_context* context,
-  vector<uint8_t> const& code,
-  vector<uint8_t> const& state_code,
-  evmc_message const& msg,
-  bool meterInterfaceGas
-) {
-  HERA_DEBUG << "Executing with wabt...\n";
-
-  // This is the wasm state
-  wabt::interp::Environment env;
-
-  // Lets instantiate our state
-  ExecutionResult result;
-
-  // FIXME: shouldn't have this loose pointer here, but needed for setWasmMemory
-  WabtEthereumInterface* interface = new WabtEthereumInterface{context, state_code, msg, result, meterInterfaceGas};
-
+WabtEnvironment::WabtEnvironment(vector<uint8_t> const& code)
+{
   // Lets add our host module
   // The lifecycle of this pointer is handled by `env`.
   wabt::interp::HostModule* hostModule = env.AppendHostModule("ethereum");
   heraAssert(hostModule, "Failed to create host module.");
-  hostModule->import_delegate = unique_ptr<WabtEthereumInterface>(interface);
+  hostImports = new WabtHostImports;
+  hostModule->import_delegate = unique_ptr<WabtHostImports>(hostImports);
 
   wabt::ReadBinaryOptions options(
     wabt::Features{},
@@ -555,24 +464,93 @@ ExecutionResult WabtEngine::execute(
   ensureCondition(module, ContractValidationFailure, "Module failed to load.");
   ensureCondition(env.GetMemoryCount() == 1, ContractValidationFailure, "Multiple memory sections exported.");
 
-  wabt::interp::Export* mainFunction = module->GetExport("main");
+  mainFunction = module->GetExport("main");
   ensureCondition(mainFunction, ContractValidationFailure, "\"main\" not found");
   ensureCondition(mainFunction->kind == wabt::ExternalKind::Func, ContractValidationFailure,  "\"main\" is not a function");
 
   // No tracing, no threads
-  wabt::interp::Executor executor(&env, nullptr, wabt::interp::Thread::Options{});
+  executor.reset(new wabt::interp::Executor(&env, nullptr, wabt::interp::Thread::Options{}));
+
+  m_initialMemory = *env.GetMemory(0);
+  for (wabt::Index i = 0; i < env.GetGlobalCount(); ++i)
+    m_initialGlobals.push_back(env.GetGlobal(i)->typed_value);
+
+  // The memory and its initial copy, and the loaded code.
+  m_idleCost = m_initialMemory.data.size() * 2 + code.size() * 8;
+}
+
+void WabtEnvironment::reset()
+{
+  // Reuses the allocation if the memory was not grown.
+  wabt::interp::Memory* memory = env.GetMemory(0);
+  memory->page_limits = m_initialMemory.page_limits;
+  memory->data.assign(m_initialMemory.data.begin(), m_initialMemory.data.end());
+  for (wabt::Index i = 0; i < m_initialGlobals.size(); ++i)
+    env.GetGlobal(i)->typed_value = m_initialGlobals[i];
+}
+
+WabtInstance::WabtInstance(shared_ptr<WabtModule const> _module):
+  m_module(move(_module))
+{
+  {
+    lock_guard<mutex> lock(m_module->environmentsMutex);
+    if (!m_module->idleEnvironments.empty()) {
+      m_environment = move(m_module->idleEnvironments.back());
+      m_module->idleEnvironments.pop_back();
+      releaseIdleState(m_environment->idleCost());
+    }
+  }
+  if (!m_environment)
+    m_environment.reset(new WabtEnvironment(m_module->code));
+}
+
+WabtInstance::~WabtInstance() noexcept
+{
+  try {
+    m_environment->reset();
+  } catch (std::bad_alloc const&) {
+    // Not reused then.
+    return;
+  }
+  lock_guard<mutex> lock(m_module->environmentsMutex);
+  if (m_module->idleEnvironments.size() < maxIdleEnvironments && reserveIdleState(m_environment->idleCost()))
+    m_module->idleEnvironments.push_back(move(m_environment));
+}
+
+ExecutionResult WabtInstance::run(
+  evmc_context* context,
+  vector<uint8_t> const& state_code,
+  evmc_message const& msg,
+  bool meterInterfaceGas
+) {
+  HERA_DEBUG << "Executing with wabt...\n";
 
-  // FIXME: really bad design
-  interface->setWasmMemory(env.GetMemory(0));
+  // Lets instantiate our state
+  ExecutionResult result;
+  WabtEthereumInterface interface{context, state_code, msg, result, meterInterfaceGas};
+
+  interface.setWasmMemory(m_environment->env.GetMemory(0));
+  m_environment->hostImports->bind(&interface);
 
   // Execute main
+  wabt::interp::ExecResult wabtResult;
   try {
-    wabt::interp::ExecResult wabtResult = executor.RunExport(mainFunction, wabt::interp::TypedValues{});
-  } catch (EndExecution const&) {
-    // This exception is ignored here because we consider it to be a success.
-    // It is only a clutch for POSIX style exit()
+    wabtResult = m_environment->executor->RunExport(m_environment->mainFunction, wabt::interp::TypedValues{});
+  } catch (...) {
+    m_environment->hostImports->bind(nullptr);
+    throw;
   }
 
+  m_environment->hostImports->bind(nullptr);
+
+  // Ending the execution stops the executor with a host trap, see WabtEthereumInterface::endExecution().
+  bool ended = wabtResult.result == wabt::interp::Result::TrapHostTrapped && interface.ended();
+  ensureCondition(
+    wabtResult.result == wabt::interp::Result::Ok || ended,
+    VMTrap,
+    string("Execution trapped: ") + wabt::interp::ResultToString(wabtResult.result)
+  );
+  interface.flushStorage();
   return result;
 }
 
@@ -25,13 +25,9 @@ public:
   /// Factory method to create the WABT Wasm Engine.
   static std::unique_ptr<WasmEngine> create();
 
-  ExecutionResult execute(
-    evmc_context* context,
-    std::vector<uint8_t> const& code,
-    std::vector<uint8_t> const& state_code,
-    evmc_message const& msg,
-    bool meterInterfaceGas
-  ) override;
+  std::shared_ptr<PreparedModule const> prepare(std::vector<uint8_t> const& code) override;
+
+  std::unique_ptr<WasmInstance> instantiate(std::shared_ptr<PreparedModule const> module) override;
 
   void verifyContract(std::vector<uint8_t> const&) override {
     // TODO: implement
@@ -0,0 +1,351 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <tuple>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include "debugging.h"
+#include "helpers.h"
+#include "wavm-object-cache.h"
+
+#define HERA_STRINGIFY_(x) #x
+#define HERA_STRINGIFY(x) HERA_STRINGIFY_(x)
+
+// Set by Hera and read by the JIT of WAVM (see cmake/patch_wavm.sh).
+llvm::ObjectCache* wavmObjectCache = nullptr;
+
+using namespace std;
+
+namespace hera {
+
+namespace {
+
+constexpr char trailerMagic[8] = { 'H', 'E', 'R', 'A', 'O', 'B', 'J', '1' };
+// Object size, key size, build hash, checksum and magic.
+constexpr size_t trailerSize = 5 * 8;
+
+constexpr size_t defaultCapacity = 1024 * 1024 * 1024;
+
+// Temporary files older than this (in seconds) were left behind by a crashed writer.
+constexpr time_t staleTemporaryAge = 600;
+
+void putLE64(string & out, uint64_t value)
+{
+  for (unsigned i = 0; i < 8; ++i)
+    out.push_back(static_cast<char>(value >> (8 * i)));
+}
+
+uint64_t getLE64(char const* in)
+{
+  uint64_t ret = 0;
+  for (unsigned i = 0; i < 8; ++i)
+    ret |= uint64_t(static_cast<uint8_t>(in[i])) << (8 * i);
+  return ret;
+}
+
+uint64_t hashString(string const& value)
+{
+  return hashBytes(reinterpret_cast<uint8_t const*>(value.data()), value.size());
+}
+
+// Identifies the compiler and the target. Object code is only reused if they match.
+uint64_t buildHash()
+{
+  static const uint64_t hash = [] {
+    string key = "wavm " HERA_STRINGIFY(HERA_WAVM_REVISION) " llvm " LLVM_VERSION_STRING " cpu ";
+    key += llvm::sys::getHostCPUName().str();
+    llvm::StringMap<bool> features;
+    if (llvm::sys::getHostCPUFeatures(features)) {
+      vector<string> names;
+      for (auto const& feature: features)
+        names.push_back((feature.second ? "+" : "-") + feature.first().str());
+      sort(names.begin(), names.end());
+      for (auto const& name: names)
+        key += " " + name;
+    }
+    return hashString(key);
+  }();
+  return hash;
+}
+
+// A mapped cache file, exposing only the object code at its start.
+class MappedObject : public llvm::MemoryBuffer {
+public:
+  MappedObject(unique_ptr<llvm::MemoryBuffer> _file, size_t size):
+    m_file(move(_file))
+  {
+    init(m_file->getBufferStart(), m_file->getBufferStart() + size, false);
+  }
+
+  BufferKind getBufferKind() const override { return m_file->getBufferKind(); }
+
+private:
+  unique_ptr<llvm::MemoryBuffer> m_file;
+};
+
+// Set while a contract is compiled on this thread, see WavmObjectCacheScope.
+thread_local bool compilingContract = false;
+
+// The IR of @module, which determines the object code compiled from it.
+string moduleKey(llvm::Module const& module)
+{
+  string ret;
+  llvm::raw_string_ostream stream(ret);
+  module.print(stream, nullptr);
+  stream.flush();
+  return ret;
+}
+
+class DirectoryCache : public llvm::ObjectCache {
+public:
+  bool open(string const& directory)
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_directory.clear();
+    wavmObjectCache = nullptr;
+
+    if (directory.empty())
+      return true;
+
+    if (mkdir(directory.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0 || !S_ISDIR(info.st_mode) || access(directory.c_str(), R_OK | W_OK | X_OK) != 0)
+      return false;
+
+    m_directory = directory;
+    evict();
+    wavmObjectCache = this;
+    HERA_DEBUG << "Caching WAVM object code in " << directory << " (" << m_size << " bytes)\n";
+    return true;
+  }
+
+  void setCapacity(size_t capacity)
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_capacity = capacity;
+    if (!m_directory.empty())
+      evict();
+  }
+
+  void notifyObjectCompiled(llvm::Module const* module, llvm::MemoryBufferRef object) override
+  {
+    if (!compilingContract || !enabled())
+      return;
+    string key = moduleKey(*module);
+
+    lock_guard<mutex> lock(m_mutex);
+    if (m_directory.empty())
+      return;
+
+    string contents(object.getBufferStart(), object.getBufferSize());
+    contents += key;
+    uint64_t checksum = hashString(contents);
+    putLE64(contents, object.getBufferSize());
+    putLE64(contents, key.size());
+    putLE64(contents, buildHash());
+    putLE64(contents, checksum);
+    contents.append(trailerMagic, sizeof(trailerMagic));
+
+    // Written to a temporary file first, readers only ever see complete files.
+    string temp = m_directory + "/.tmp-" + to_string(getpid()) + "-" + to_string(m_tempCounter++);
+    string file = path(key);
+    FILE* out = fopen(temp.c_str(), "wb");
+    bool written = out && fwrite(contents.data(), 1, contents.size(), out) == contents.size();
+    if (out)
+      written = (fclose(out) == 0) && written;
+    if (!written || rename(temp.c_str(), file.c_str()) != 0) {
+      HERA_DEBUG << "Failed to write WAVM object code to " << file << "\n";
+      unlink(temp.c_str());
+      return;
+    }
+
+    HERA_DEBUG << "Stored WAVM object code in " << file << " (" << contents.size() << " bytes)\n";
+    m_size += contents.size();
+    if (m_size > m_capacity)
+      evict();
+  }
+
+  unique_ptr<llvm::MemoryBuffer> getObject(llvm::Module const* module) override
+  {
+    if (!compilingContract || !enabled())
+      return nullptr;
+    string key = moduleKey(*module);
+
+    string file;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_directory.empty())
+        return nullptr;
+      file = path(key);
+    }
+
+    auto buffer = llvm::MemoryBuffer::getFile(file, -1, false);
+    if (!buffer)
+      return nullptr;
+    unique_ptr<llvm::MemoryBuffer> mapped = move(*buffer);
+
+    size_t objectSize;
+    if (!verify(*mapped, key, objectSize)) {
+      HERA_DEBUG << "Discarding invalid WAVM object code in " << file << "\n";
+      unlink(file.c_str());
+      return nullptr;
+    }
+
+    // Keep the recently used files when evicting.
+    utime(file.c_str(), nullptr);
+    HERA_DEBUG << "Loaded WAVM object code from " << file << "\n";
+    return unique_ptr<llvm::MemoryBuffer>{new MappedObject(move(mapped), objectSize)};
+  }
+
+private:
+  bool enabled()
+  {
+    lock_guard<mutex> lock(m_mutex);
+    return !m_directory.empty();
+  }
+
+  string path(string const& key) const
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "/%016llx-%016llx.o",
+      static_cast<unsigned long long>(hashString(key)),
+      static_cast<unsigned long long>(buildHash()));
+    return m_directory + name;
+  }
+
+  static bool verify(llvm::MemoryBuffer const& buffer, string const& key, size_t & objectSize)
+  {
+    size_t size = buffer.getBufferSize();
+    if (size < trailerSize)
+      return false;
+    char const* data = buffer.getBufferStart();
+    char const* trailer = data + size - trailerSize;
+    if (memcmp(trailer + 32, trailerMagic, sizeof(trailerMagic)) != 0)
+      return false;
+
+    uint64_t storedObjectSize = getLE64(trailer);
+    uint64_t storedKeySize = getLE64(trailer + 8);
+    if (getLE64(trailer + 16) != buildHash())
+      return false;
+    if (storedKeySize != key.size() || storedObjectSize != size - trailerSize - storedKeySize)
+      return false;
+    if (memcmp(data + storedObjectSize, key.data(), key.size()) != 0)
+      return false;
+    if (getLE64(trailer + 24) != hashBytes(reinterpret_cast<uint8_t const*>(data), size - trailerSize))
+      return false;
+
+    objectSize = storedObjectSize;
+    return true;
+  }
+
+  // Recomputes the size of the directory and removes the least recently used
+  // files until it fits. Temporary files left behind by a crashed writer are
+  // removed as well. Must be called with the mutex held.
+  void evict()
+  {
+    DIR* dir = opendir(m_directory.c_str());
+    if (!dir)
+      return;
+
+    vector<tuple<time_t, size_t, string>> files;
+    m_size = 0;
+    time_t now = time(nullptr);
+    while (dirent* entry = readdir(dir)) {
+      string name = entry->d_name;
+      bool temporary = name.compare(0, 5, ".tmp-") == 0;
+      if (!temporary && (name.size() < 2 || name.compare(name.size() - 2, 2, ".o") != 0))
+        continue;
+      string file = m_directory + "/" + name;
+      struct stat info;
+      if (stat(file.c_str(), &info) != 0 || !S_ISREG(info.st_mode))
+        continue;
+      if (temporary) {
+        // Another process may still be writing a recent one.
+        if (now - info.st_mtime > staleTemporaryAge)
+          unlink(file.c_str());
+        continue;
+      }
+      files.emplace_back(info.st_mtime, static_cast<size_t>(info.st_size), move(file));
+      m_size += static_cast<size_t>(info.st_size);
+    }
+    closedir(dir);
+
+    sort(files.begin(), files.end());
+    for (auto const& file: files) {
+      if (m_size <= m_capacity)
+        break;
+      if (unlink(get<2>(file).c_str()) == 0)
+        m_size -= get<1>(file);
+    }
+  }
+
+  mutex m_mutex;
+  string m_directory;
+  size_t m_capacity = defaultCapacity;
+  size_t m_size = 0;
+  unsigned m_tempCounter = 0;
+};
+
+// Never destroyed, the JIT may still hold the pointer at exit.
+DirectoryCache& cache()
+{
+  static DirectoryCache* instance = new DirectoryCache;
+  return *instance;
+}
+
+}
+
+bool wavmObjectCacheOpen(string const& directory)
+{
+  return cache().open(directory);
+}
+
+void wavmObjectCacheSetSize(size_t size)
+{
+  cache().setCapacity(size);
+}
+
+WavmObjectCacheScope::WavmObjectCacheScope()
+{
+  compilingContract = true;
+}
+
+WavmObjectCacheScope::~WavmObjectCacheScope()
+{
+  compilingContract = false;
+}
+
+}
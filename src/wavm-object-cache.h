@@ -0,0 +1,62 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace hera {
+
+/// A directory of object code compiled by the WAVM JIT, so that contracts are
+/// not compiled again after a restart. It is process-wide, as the JIT is.
+///
+/// Object code is keyed by the LLVM IR it was compiled from, not by the contract:
+/// the JIT of WAVM builds values of the instance (e.g. the addresses of imported
+/// functions and the ids of its memory and table) into the code, which must
+/// not be reused by another instance. Such code is only found again if the IR,
+/// including these values, is identical, which in practice is never the case
+/// after a restart. The wavm-cache-dir option is therefore only available if
+/// built with HERA_WAVM_OBJECT_CACHE, until WAVM loads these values through
+/// the runtime data of the context and the code can be keyed by the contract.
+///
+/// Each file holds the object code, followed by the IR (compared on load, so a
+/// hash collision is only a miss) and a trailer with a checksum. The file name
+/// is derived from the IR and from the WAVM revision, the LLVM version and the
+/// host CPU. Files are written to a temporary name and renamed, so a reader
+/// never sees a partial file, and are mapped into memory when loaded.
+///
+/// The JIT reaches the cache through the hook added by cmake/patch_wavm.sh.
+
+/// Uses @directory (created if missing) for the cache. An empty path disables it.
+/// @returns false if the directory cannot be used.
+bool wavmObjectCacheOpen(std::string const& directory);
+
+/// Limits the size of the directory. The least recently used files are removed first.
+void wavmObjectCacheSetSize(size_t size);
+
+/// Marks the compilations of a contract on this thread while the scope is alive.
+/// Compilations outside of a scope (e.g. of the host module) are not cached.
+class WavmObjectCacheScope {
+public:
+  WavmObjectCacheScope();
+  ~WavmObjectCacheScope();
+
+  WavmObjectCacheScope(WavmObjectCacheScope const&) = delete;
+  WavmObjectCacheScope& operator=(WavmObjectCacheScope const&) = delete;
+};
+
+}
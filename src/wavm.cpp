@@ -15,9 +15,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <iostream>
 #include <memory>
-#include <stack>
+#include <mutex>
+#include <utility>
+#include <vector>
 
 #include "wavm.h"
 
@@ -33,6 +36,8 @@
 #include "debugging.h"
 #include "eei.h"
 #include "exceptions.h"
+#include "idle-budget.h"
+#include "wavm-object-cache.h"
 
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #pragma GCC diagnostic ignored "-Wunused-variable"
@@ -60,8 +65,7 @@ public:
 private:
   // These assume that m_wasmMemory was set prior to execution.
   size_t memorySize() const override { return Runtime::getMemoryNumPages(m_wasmMemory) * 65536; }
-  void memorySet(size_t offset, uint8_t value) override { (Runtime::memoryArrayPtr<U8>(m_wasmMemory, offset, 1))[0] = value; }
-  uint8_t memoryGet(size_t offset) override { return (Runtime::memoryArrayPtr<U8>(m_wasmMemory, offset, 1))[0]; }
+  uint8_t* memoryData() override { return Runtime::memoryArrayPtr<U8>(m_wasmMemory, 0, memorySize()); }
 
   Runtime::MemoryInstance* m_wasmMemory;
 };
@@ -72,8 +76,22 @@ unique_ptr<WasmEngine> WavmEngine::create()
 }
 
 namespace wavm_host_module {
-  // first the ethereum interface(s), the top of the stack is used in host functions
-  stack<WavmEthereumInterface*> interface;
+  // The ethereum interface of each execution in progress on this thread, the most recent last.
+  // WAVM has no user data for contexts, so host functions look theirs up by the context they run in.
+  thread_local vector<pair<Runtime::Context*, WavmEthereumInterface*>> interfaces;
+
+  WavmEthereumInterface& interface(Runtime::ContextRuntimeData* contextRuntimeData)
+  {
+    Runtime::Context* context = Runtime::getContextFromRuntimeData(contextRuntimeData);
+    // Nested executions run in their own context, the innermost one is found first.
+    for (auto it = interfaces.rbegin(); it != interfaces.rend(); ++it)
+      if (it->first == context)
+        return *it->second;
+    throw InternalErrorException{"Host function called outside of an execution."};
+  }
+
+  // The object lists and the garbage collector of the runtime are global.
+  mutex runtimeMutex;
 
 
   // the host module is called 'ethereum'
@@ -83,85 +101,229 @@ namespace wavm_host_module {
   // host functions follow
   DEFINE_INTRINSIC_FUNCTION(ethereum, "useGas", void, useGas, I64 amount)
   {
-    interface.top()->eeiUseGas(amount);
+    interface(contextRuntimeData).eeiUseGas(amount);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getGasLeft", U64, getGasLeft)
+  {
+    return static_cast<U64>(interface(contextRuntimeData).eeiGetGasLeft());
   }
 
 
   DEFINE_INTRINSIC_FUNCTION(ethereum, "getAddress", void, getAddress, U32 resultOffset)
   {
-    interface.top()->eeiGetAddress(resultOffset);
+    interface(contextRuntimeData).eeiGetAddress(resultOffset);
   }
 
 
-  DEFINE_INTRINSIC_FUNCTION(ethereum, "call", U32, call, I64 gas, U32 addressOffset, U32 valueOffset, U32 dataOffset, U32 dataLength)
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getExternalBalance", void, getExternalBalance, U32 addressOffset, U32 resultOffset)
   {
-    return interface.top()->eeiCall(EthereumInterface::EEICallKind::Call, gas, addressOffset, valueOffset, dataOffset, dataLength);
+    interface(contextRuntimeData).eeiGetExternalBalance(addressOffset, resultOffset);
   }
 
 
-  DEFINE_INTRINSIC_FUNCTION(ethereum, "callDataCopy", void, callDataCopy, U32 resultOffset, U32 dataOffset, U32 length)
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getBlockHash", U32, getBlockHash, U64 number, U32 resultOffset)
   {
-    interface.top()->eeiCallDataCopy(resultOffset, dataOffset, length);
+    return interface(contextRuntimeData).eeiGetBlockHash(number, resultOffset);
   }
 
 
   DEFINE_INTRINSIC_FUNCTION(ethereum, "getCallDataSize", U32, getCallDataSize)
   {
-    return interface.top()->eeiGetCallDataSize();
+    return interface(contextRuntimeData).eeiGetCallDataSize();
   }
 
 
-  DEFINE_INTRINSIC_FUNCTION(ethereum, "getGasLeft", U64, getGasLeft)
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "callDataCopy", void, callDataCopy, U32 resultOffset, U32 dataOffset, U32 length)
   {
-    return static_cast<U64>(interface.top()->eeiGetGasLeft());
+    interface(contextRuntimeData).eeiCallDataCopy(resultOffset, dataOffset, length);
   }
 
 
-  DEFINE_INTRINSIC_FUNCTION(ethereum, "storageStore", void, storageStore, U32 pathOffset, U32 valueOffset)
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getCaller", void, getCaller, U32 resultOffset)
   {
-    interface.top()->eeiStorageStore(pathOffset, valueOffset);
+    interface(contextRuntimeData).eeiGetCaller(resultOffset);
   }
 
 
-  DEFINE_INTRINSIC_FUNCTION(ethereum, "storageLoad", void, storageLoad, U32 pathOffset, U32 valueOffset)
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getCallValue", void, getCallValue, U32 resultOffset)
   {
-    interface.top()->eeiStorageLoad(pathOffset, valueOffset);
+    interface(contextRuntimeData).eeiGetCallValue(resultOffset);
   }
 
 
   DEFINE_INTRINSIC_FUNCTION(ethereum, "codeCopy", void, codeCopy, U32 resultOffset, U32 codeOffset, U32 length)
   {
-    interface.top()->eeiCodeCopy(resultOffset, codeOffset, length);
+    interface(contextRuntimeData).eeiCodeCopy(resultOffset, codeOffset, length);
   }
 
 
   DEFINE_INTRINSIC_FUNCTION(ethereum, "getCodeSize", U32, getCodeSize)
   {
-    return interface.top()->eeiGetCodeSize();
+    return interface(contextRuntimeData).eeiGetCodeSize();
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "externalCodeCopy", void, externalCodeCopy, U32 addressOffset, U32 resultOffset, U32 codeOffset, U32 length)
+  {
+    interface(contextRuntimeData).eeiExternalCodeCopy(addressOffset, resultOffset, codeOffset, length);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getExternalCodeSize", U32, getExternalCodeSize, U32 addressOffset)
+  {
+    return interface(contextRuntimeData).eeiGetExternalCodeSize(addressOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getExternalCodeHash", void, getExternalCodeHash, U32 addressOffset, U32 resultOffset)
+  {
+    interface(contextRuntimeData).eeiGetExternalCodeHash(addressOffset, resultOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getBlockCoinbase", void, getBlockCoinbase, U32 resultOffset)
+  {
+    interface(contextRuntimeData).eeiGetBlockCoinbase(resultOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getBlockDifficulty", void, getBlockDifficulty, U32 resultOffset)
+  {
+    interface(contextRuntimeData).eeiGetBlockDifficulty(resultOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getBlockGasLimit", I64, getBlockGasLimit)
+  {
+    return interface(contextRuntimeData).eeiGetBlockGasLimit();
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getTxGasPrice", void, getTxGasPrice, U32 valueOffset)
+  {
+    interface(contextRuntimeData).eeiGetTxGasPrice(valueOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "log", void, log, U32 dataOffset, U32 length, U32 numberOfTopics, U32 topic1, U32 topic2, U32 topic3, U32 topic4)
+  {
+    interface(contextRuntimeData).eeiLog(dataOffset, length, numberOfTopics, topic1, topic2, topic3, topic4);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getBlockNumber", I64, getBlockNumber)
+  {
+    return interface(contextRuntimeData).eeiGetBlockNumber();
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getBlockTimestamp", I64, getBlockTimestamp)
+  {
+    return interface(contextRuntimeData).eeiGetBlockTimestamp();
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getTxOrigin", void, getTxOrigin, U32 resultOffset)
+  {
+    interface(contextRuntimeData).eeiGetTxOrigin(resultOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getChainID", I64, getChainID)
+  {
+    return interface(contextRuntimeData).eeiGetChainID();
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getSelfBalance", void, getSelfBalance, U32 resultOffset)
+  {
+    interface(contextRuntimeData).eeiGetSelfBalance(resultOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "getBasefee", I64, getBasefee)
+  {
+    return interface(contextRuntimeData).eeiGetBasefee();
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "storageStore", void, storageStore, U32 pathOffset, U32 valueOffset)
+  {
+    interface(contextRuntimeData).eeiStorageStore(pathOffset, valueOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "storageLoad", void, storageLoad, U32 pathOffset, U32 valueOffset)
+  {
+    interface(contextRuntimeData).eeiStorageLoad(pathOffset, valueOffset);
   }
 
 
   DEFINE_INTRINSIC_FUNCTION(ethereum, "finish", void, finish, U32 dataOffset, U32 length)
   {
-    interface.top()->eeiFinish(dataOffset, length);
+    interface(contextRuntimeData).eeiFinish(dataOffset, length);
   }
 
 
   DEFINE_INTRINSIC_FUNCTION(ethereum, "revert", void, revert, U32 dataOffset, U32 length)
   {
-    interface.top()->eeiRevert(dataOffset, length);
+    interface(contextRuntimeData).eeiRevert(dataOffset, length);
   }
 
 
   DEFINE_INTRINSIC_FUNCTION(ethereum, "getReturnDataSize", U32, getReturnDataSize)
   {
-    return interface.top()->eeiGetReturnDataSize();
+    return interface(contextRuntimeData).eeiGetReturnDataSize();
   }
 
 
   DEFINE_INTRINSIC_FUNCTION(ethereum, "returnDataCopy", void, returnDataCopy, U32 resultOffset, U32 dataOffset, U32 length)
   {
-    return interface.top()->eeiReturnDataCopy(resultOffset, dataOffset, length);
+    interface(contextRuntimeData).eeiReturnDataCopy(resultOffset, dataOffset, length);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "call", U32, call, I64 gas, U32 addressOffset, U32 valueOffset, U32 dataOffset, U32 dataLength)
+  {
+    return interface(contextRuntimeData).eeiCall(EthereumInterface::EEICallKind::Call, gas, addressOffset, valueOffset, dataOffset, dataLength);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "callCode", U32, callCode, I64 gas, U32 addressOffset, U32 valueOffset, U32 dataOffset, U32 dataLength)
+  {
+    return interface(contextRuntimeData).eeiCall(EthereumInterface::EEICallKind::CallCode, gas, addressOffset, valueOffset, dataOffset, dataLength);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "callDelegate", U32, callDelegate, I64 gas, U32 addressOffset, U32 dataOffset, U32 dataLength)
+  {
+    return interface(contextRuntimeData).eeiCall(EthereumInterface::EEICallKind::CallDelegate, gas, addressOffset, 0, dataOffset, dataLength);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "callStatic", U32, callStatic, I64 gas, U32 addressOffset, U32 dataOffset, U32 dataLength)
+  {
+    return interface(contextRuntimeData).eeiCall(EthereumInterface::EEICallKind::CallStatic, gas, addressOffset, 0, dataOffset, dataLength);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "create", U32, create, U32 valueOffset, U32 dataOffset, U32 length, U32 resultOffset)
+  {
+    return interface(contextRuntimeData).eeiCreate(valueOffset, dataOffset, length, resultOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "create2", U32, create2, U32 valueOffset, U32 dataOffset, U32 length, U32 saltOffset, U32 resultOffset)
+  {
+    return interface(contextRuntimeData).eeiCreate2(valueOffset, dataOffset, length, saltOffset, resultOffset);
+  }
+
+
+  DEFINE_INTRINSIC_FUNCTION(ethereum, "selfDestruct", void, selfDestruct, U32 addressOffset)
+  {
+    interface(contextRuntimeData).eeiSelfDestruct(addressOffset);
   }
 
 
@@ -186,39 +348,187 @@ namespace wavm_host_module {
   };
 } // namespace wavm_host_module
 
-ExecutionResult WavmEngine::execute(
-  evmc_context* context,
-  vector<uint8_t> const& code,
-  vector<uint8_t> const& state_code,
-  evmc_message const& msg,
-  bool meterInterfaceGas
-) {
-  ExecutionResult result = internalExecute(context, code, state_code, msg, meterInterfaceGas);
-  // And clean up mess left by this run.
-  Runtime::collectGarbage();
-  return result;
+namespace {
+
+// The compartment shared by all instances, with the host module instantiated once.
+// Compiled contracts are instantiated into it and reused, see WavmTemplate.
+struct WavmRuntime {
+  Runtime::GCPointer<Runtime::Compartment> compartment;
+  Runtime::GCPointer<Runtime::ModuleInstance> ethereumHostModule;
+};
+
+// Must be called with runtimeMutex held. It is never destroyed, as it would
+// outlive the globals of WAVM at exit.
+WavmRuntime& runtime()
+{
+  static WavmRuntime* instance = nullptr;
+  if (!instance) {
+    instance = new WavmRuntime;
+    instance->compartment = Runtime::createCompartment();
+    HashMap<string, Runtime::Object*> extraEthereumExports; //empty for current ewasm stuff
+    instance->ethereumHostModule = Intrinsics::instantiateModule(instance->compartment, wavm_host_module::INTRINSIC_MODULE_REF(ethereum), "ethereum", extraEthereumExports);
+    heraAssert(instance->ethereumHostModule, "Failed to create host module.");
+  }
+  return *instance;
 }
 
-ExecutionResult WavmEngine::internalExecute(
-  evmc_context* context,
-  vector<uint8_t> const& code,
-  vector<uint8_t> const& state_code,
-  evmc_message const& msg,
-  bool meterInterfaceGas
-) {
-  HERA_DEBUG << "Executing with wavm...\n";
+// Garbage is collected after this many roots (the context of every execution and
+// the instances of released templates) were dropped, instead of after each one.
+constexpr unsigned garbageCollectionInterval = 32;
+// Guarded by runtimeMutex.
+unsigned releasedRoots = 0;
+// Templates being instantiated, guarded by runtimeMutex. Their module instance is
+// not rooted yet, so no garbage is collected while there are any.
+unsigned instantiatingTemplates = 0;
+
+// Must be called with runtimeMutex held after dropping a root. The contexts and
+// memories left behind take slots of the shared compartment until collected.
+void rootReleased()
+{
+  if (++releasedRoots >= garbageCollectionInterval && instantiatingTemplates == 0) {
+    releasedRoots = 0;
+    Runtime::collectGarbage();
+  }
+}
 
-  // set up a new ethereum interface just for this contract invocation
-  ExecutionResult result;
-  WavmEthereumInterface interface{context, state_code, msg, result, meterInterfaceGas};
-  wavm_host_module::interface.push(&interface);
+// The JIT of WAVM shares one LLVM context, so compilations still run one at a time.
+mutex compileMutex;
+
+// Releases runtimeMutex while WAVM compiles the contract being instantiated on
+// this thread, see wavmCompileBegin() and cmake/patch_wavm.sh. Executions and
+// the release of templates are not blocked by a compilation.
+class InstantiationScope {
+public:
+  explicit InstantiationScope(unique_lock<mutex>& runtimeLock):
+    m_runtimeLock(runtimeLock), m_compileLock(compileMutex, defer_lock)
+  {
+    ++instantiatingTemplates;
+    current = this;
+  }
+
+  ~InstantiationScope() noexcept
+  {
+    current = nullptr;
+    if (m_compileLock)
+      m_compileLock.unlock();
+    if (!m_runtimeLock)
+      m_runtimeLock.lock();
+    --instantiatingTemplates;
+  }
+
+  InstantiationScope(InstantiationScope const&) = delete;
+  InstantiationScope& operator=(InstantiationScope const&) = delete;
+
+  static void compileBegin()
+  {
+    if (!current)
+      return;
+    current->m_runtimeLock.unlock();
+    current->m_compileLock.lock();
+  }
+
+  static void compileEnd()
+  {
+    if (!current)
+      return;
+    current->m_compileLock.unlock();
+    current->m_runtimeLock.lock();
+  }
+
+private:
+  static thread_local InstantiationScope* current;
+
+  unique_lock<mutex>& m_runtimeLock;
+  unique_lock<mutex> m_compileLock;
+};
+
+thread_local InstantiationScope* InstantiationScope::current = nullptr;
+
+// Idle templates kept for each module, more, or those beyond the budget of
+// reserveIdleState(), are released.
+constexpr size_t maxIdleTemplates = 8;
+
+constexpr Uptr wasmPageSize = 65536;
+
+}
+
+// A compiled instance of a contract in the shared compartment. It is reset to
+// its state after instantiation between executions, which avoids compiling
+// the contract again. The mutable globals live in the Context, which is
+// created for every execution.
+struct WavmModule;
+
+struct WavmTemplate {
+  explicit WavmTemplate(WavmModule const& module);
+  ~WavmTemplate() noexcept;
+
+  WavmTemplate(WavmTemplate const&) = delete;
+  WavmTemplate& operator=(WavmTemplate const&) = delete;
+
+  /// Restores the memory as it was after instantiation.
+  void reset();
+
+  /// Rough estimate of the memory kept while idle, for reserveIdleState().
+  size_t idleCost = 0;
+
+  Runtime::GCPointer<Runtime::ModuleInstance> moduleInstance;
+  Runtime::GCPointer<Runtime::FunctionInstance> mainFunction;
+  Runtime::MemoryInstance* memory = nullptr;
+  Uptr initialPages = 0;
+  vector<U8> initialMemory;
+};
+
+// A parsed and validated module.
+struct WavmModule : PreparedModule {
+  IR::Module module;
+  // Identifies the compiled code in the object cache.
+  vector<uint8_t> code;
+
+  // Compiled templates not in use by an execution, reserved by reserveIdleState().
+  mutable mutex templatesMutex;
+  mutable vector<unique_ptr<WavmTemplate>> idleTemplates;
+  // Set by WavmEngine::precompile(), one template is then kept outside the budget.
+  mutable bool pinned = false;
+  mutable unique_ptr<WavmTemplate> pinnedTemplate;
+
+  ~WavmModule() noexcept override
+  {
+    for (auto const& idle: idleTemplates)
+      releaseIdleState(idle->idleCost);
+  }
+
+  // Only a rough estimate of the in-memory representation.
+  size_t memoryCost() const override { return code.size() * 8; }
+};
+
+class WavmInstance : public WasmInstance {
+public:
+  explicit WavmInstance(shared_ptr<WavmModule const> _module);
+  ~WavmInstance() noexcept override;
+
+  ExecutionResult run(
+    evmc_context* context,
+    vector<uint8_t> const& state_code,
+    evmc_message const& msg,
+    bool meterInterfaceGas
+  ) override;
+
+private:
+  shared_ptr<WavmModule const> m_module;
+  unique_ptr<WavmTemplate> m_template;
+  // context stores the mutable state of an execution
+  Runtime::GCPointer<Runtime::Context> m_context;
+};
+
+shared_ptr<PreparedModule const> WavmEngine::prepare(vector<uint8_t> const& code)
+{
+  auto module = make_shared<WavmModule>();
+  module->code = code;
 
-  // first parse module
-  IR::Module moduleAST;
   try {
     // NOTE: this expects U8, which is a typedef over uint8_t
     Serialization::MemoryInputStream input(code.data(), code.size());
-    WASM::serialize(input, moduleAST);
+    WASM::serialize(input, module->module);
   } catch (Serialization::FatalSerializationException const& e) {
     ensureCondition(false, ContractValidationFailure, "Failed to deserialise contract: " + e.message);
   } catch (IR::ValidationException const& e) {
@@ -228,54 +538,168 @@ ExecutionResult WavmEngine::internalExecute(
     ensureCondition(false, ContractValidationFailure, "Bug in wavm: didn't check bounds before allocation");
   }
 
-  // next set up the host module.
-  // Note: in ewasm, we create a new VM for each call to a module, so we must instantiate a new host module for each of these VMs, this is inefficient, but OK for prototyping.
-  // compartment is like the Wasm store, represents the VM, has lists of globals, memories, tables, and also has wavm's runtime stuff
-  Runtime::GCPointer<Runtime::Compartment> compartment = Runtime::createCompartment();
-  // context stores the compartment and some other stuff
-  Runtime::GCPointer<Runtime::Context> wavm_context = Runtime::createContext(compartment);
-  // instantiate host Module
-  HashMap<string, Runtime::Object*> extraEthereumExports; //empty for current ewasm stuff
-  Runtime::GCPointer<Runtime::ModuleInstance> ethereumHostModule = Intrinsics::instantiateModule(compartment, wavm_host_module::INTRINSIC_MODULE_REF(ethereum), "ethereum", extraEthereumExports);
-  heraAssert(ethereumHostModule, "Failed to create host module.");
+  return module;
+}
+
+unique_ptr<WasmInstance> WavmEngine::instantiate(shared_ptr<PreparedModule const> module)
+{
+  auto wavmModule = dynamic_pointer_cast<WavmModule const>(module);
+  heraAssert(wavmModule, "Module was not prepared by wavm.");
+  return unique_ptr<WasmInstance>{new WavmInstance(move(wavmModule))};
+}
+
+void WavmEngine::precompile(shared_ptr<PreparedModule const> const& module)
+{
+  auto wavmModule = dynamic_pointer_cast<WavmModule const>(module);
+  heraAssert(wavmModule, "Module was not prepared by wavm.");
+
+  unique_ptr<WavmTemplate> compiled{new WavmTemplate(*wavmModule)};
+  lock_guard<mutex> lock(wavmModule->templatesMutex);
+  wavmModule->pinned = true;
+  if (!wavmModule->pinnedTemplate)
+    wavmModule->pinnedTemplate = move(compiled);
+}
+
+WavmTemplate::WavmTemplate(WavmModule const& module)
+{
+  unique_lock<mutex> lock(wavm_host_module::runtimeMutex);
+  WavmRuntime& shared = runtime();
+
   // prepare contract module to resolve links against host module
-  wavm_host_module::HeraWavmResolver resolver(compartment);
-  resolver.moduleNameToInstanceMap.set("ethereum", ethereumHostModule);
-  Runtime::LinkResult linkResult = Runtime::linkModule(moduleAST, resolver);
+  wavm_host_module::HeraWavmResolver resolver(shared.compartment);
+  resolver.moduleNameToInstanceMap.set("ethereum", shared.ethereumHostModule);
+  Runtime::LinkResult linkResult = Runtime::linkModule(module.module, resolver);
   heraAssert(linkResult.success, "Couldn't link contract against host module.");
 
-  // instantiate contract module
-  Runtime::GCPointer<Runtime::ModuleInstance> moduleInstance = Runtime::instantiateModule(compartment, moduleAST, move(linkResult.resolvedImports), "<ewasmcontract>");
+  // instantiate (and compile) contract module
+  {
+    InstantiationScope instantiationScope(lock);
+    WavmObjectCacheScope objectCacheScope;
+    moduleInstance = Runtime::instantiateModule(shared.compartment, module.module, move(linkResult.resolvedImports), "<ewasmcontract>");
+  }
   heraAssert(moduleInstance, "Couldn't instantiate contact module.");
 
   // get memory for easy access in host functions
-  wavm_host_module::interface.top()->setWasmMemory(asMemory(Runtime::getInstanceExport(moduleInstance, "memory")));
+  memory = asMemory(Runtime::getInstanceExport(moduleInstance, "memory"));
 
-  // invoke the main function
-  Runtime::GCPointer<Runtime::FunctionInstance> mainFunction = asFunctionNullable(Runtime::getInstanceExport(moduleInstance, "main"));
+  mainFunction = asFunctionNullable(Runtime::getInstanceExport(moduleInstance, "main"));
   ensureCondition(mainFunction, ContractValidationFailure, "\"main\" not found");
 
+  initialPages = Runtime::getMemoryNumPages(memory);
+  U8* data = Runtime::memoryArrayPtr<U8>(memory, 0, initialPages * wasmPageSize);
+  initialMemory.assign(data, data + initialPages * wasmPageSize);
+
+  // The memory and its initial copy, and the compiled code.
+  idleCost = initialMemory.size() * 2 + module.code.size() * 8;
+}
+
+WavmTemplate::~WavmTemplate() noexcept
+{
+  // Release the roots, the objects are collected on the next garbage collection.
+  lock_guard<mutex> lock(wavm_host_module::runtimeMutex);
+  mainFunction = nullptr;
+  moduleInstance = nullptr;
+  rootReleased();
+}
+
+void WavmTemplate::reset()
+{
+  Uptr pages = Runtime::getMemoryNumPages(memory);
+  if (pages > initialPages)
+    Runtime::shrinkMemory(memory, pages - initialPages);
+  U8* data = Runtime::memoryArrayPtr<U8>(memory, 0, initialMemory.size());
+  copy(initialMemory.begin(), initialMemory.end(), data);
+}
+
+WavmInstance::WavmInstance(shared_ptr<WavmModule const> _module):
+  m_module(move(_module))
+{
+  {
+    lock_guard<mutex> lock(m_module->templatesMutex);
+    if (!m_module->idleTemplates.empty()) {
+      m_template = move(m_module->idleTemplates.back());
+      m_module->idleTemplates.pop_back();
+      releaseIdleState(m_template->idleCost);
+    } else if (m_module->pinnedTemplate) {
+      m_template = move(m_module->pinnedTemplate);
+    }
+  }
+  if (!m_template)
+    m_template.reset(new WavmTemplate(*m_module));
+
+  lock_guard<mutex> lock(wavm_host_module::runtimeMutex);
+  m_context = Runtime::createContext(runtime().compartment);
+}
+
+WavmInstance::~WavmInstance() noexcept
+{
+  {
+    lock_guard<mutex> lock(wavm_host_module::runtimeMutex);
+    m_context = nullptr;
+    rootReleased();
+  }
+
+  m_template->reset();
+  lock_guard<mutex> lock(m_module->templatesMutex);
+  if (m_module->pinned && !m_module->pinnedTemplate)
+    m_module->pinnedTemplate = move(m_template);
+  else if (m_module->idleTemplates.size() < maxIdleTemplates && reserveIdleState(m_template->idleCost))
+    m_module->idleTemplates.push_back(move(m_template));
+}
+
+ExecutionResult WavmInstance::run(
+  evmc_context* context,
+  vector<uint8_t> const& state_code,
+  evmc_message const& msg,
+  bool meterInterfaceGas
+) {
+  HERA_DEBUG << "Executing with wavm...\n";
+
+  // set up a new ethereum interface just for this contract invocation
+  ExecutionResult result;
+  WavmEthereumInterface interface{context, state_code, msg, result, meterInterfaceGas};
+  interface.setWasmMemory(m_template->memory);
+  wavm_host_module::interfaces.emplace_back(m_context, &interface);
+
   // this is how WAVM's try/catch for exceptions
-  Runtime::catchRuntimeExceptions(
-    [&] {
-      try {
-        vector<IR::Value> invokeArgs;
-        Runtime::invokeFunctionChecked(wavm_context, mainFunction, invokeArgs);
-      } catch (EndExecution const&) {
-        // This exception is ignored here because we consider it to be a success.
-        // It is only a clutch for POSIX style exit()
+  try {
+    Runtime::catchRuntimeExceptions(
+      [&] {
+        try {
+          vector<IR::Value> invokeArgs;
+          Runtime::invokeFunctionChecked(m_context, m_template->mainFunction, invokeArgs);
+        } catch (EndExecution const&) {
+          // This exception is ignored here because we consider it to be a success.
+          // It is only a clutch for POSIX style exit()
+          // This engine keeps the default endExecution(), see EthereumInterface.
+        }
+      },
+      [&](Runtime::Exception&& exception) {
+        // FIXME: decide if each of the exception fit into VMTrap/InternalError
+        ensureCondition(false, VMTrap, Runtime::describeException(exception));
       }
-    },
-    [&](Runtime::Exception&& exception) {
-      // FIXME: decide if each of the exception fit into VMTrap/InternalError
-      ensureCondition(false, VMTrap, Runtime::describeException(exception));
-    }
-  );
+    );
+  } catch (...) {
+    wavm_host_module::interfaces.pop_back();
+    throw;
+  }
 
   // clean up
-  wavm_host_module::interface.pop();
+  wavm_host_module::interfaces.pop_back();
+  interface.flushStorage();
 
   return result;
 }
 
 } // namespace hera
+
+// Called by WAVM around the compilation in Runtime::instantiateModule (see cmake/patch_wavm.sh).
+void wavmCompileBegin()
+{
+  hera::InstantiationScope::compileBegin();
+}
+
+void wavmCompileEnd()
+{
+  hera::InstantiationScope::compileEnd();
+}
@@ -26,26 +26,17 @@ public:
   /// Factory method to create the WAVM Wasm Engine.
   static std::unique_ptr<WasmEngine> create();
 
-  ExecutionResult execute(
-    evmc_context* context,
-    std::vector<uint8_t> const& code,
-    std::vector<uint8_t> const& state_code,
-    evmc_message const& msg,
-    bool meterInterfaceGas
-  ) override;
+  std::shared_ptr<PreparedModule const> prepare(std::vector<uint8_t> const& code) override;
+
+  std::unique_ptr<WasmInstance> instantiate(std::shared_ptr<PreparedModule const> module) override;
+
+  /// Compiles @module and keeps the result with it, outside the budget of
+  /// reserveIdleState(), so that its next instantiation does not compile.
+  void precompile(std::shared_ptr<PreparedModule const> const& module);
 
   void verifyContract(std::vector<uint8_t> const&) override {
     // TODO: implement
   }
-
-private:
-  ExecutionResult internalExecute(
-    evmc_context* context,
-    std::vector<uint8_t> const& code,
-    std::vector<uint8_t> const& state_code,
-    evmc_message const& msg,
-    bool meterInterfaceGas
-  );
 };
 
 } // namespace hera
@@ -0,0 +1,329 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares the gas charged by the metering of metering=true (useGas calls, as
+// injected by the Sentinel) with the one of metering=native (a gas counter) on
+// random contracts. Both must charge the same costs at the same places in the
+// code, so that every execution path uses the same gas in both modes.
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "exceptions.h"
+#include "metering.h"
+
+using namespace std;
+using namespace hera;
+
+namespace {
+
+constexpr unsigned iterations = 2000;
+constexpr unsigned maxDepth = 4;
+
+mt19937_64 rng(0x68657261);
+
+void writeU32(vector<uint8_t>& out, uint32_t value)
+{
+  do {
+    uint8_t b = value & 0x7f;
+    value >>= 7;
+    out.push_back(value ? (b | 0x80) : b);
+  } while (value);
+}
+
+void writeName(vector<uint8_t>& out, string const& name)
+{
+  writeU32(out, static_cast<uint32_t>(name.size()));
+  out.insert(out.end(), name.begin(), name.end());
+}
+
+void writeSection(vector<uint8_t>& out, uint8_t id, vector<uint8_t> const& payload)
+{
+  out.push_back(id);
+  writeU32(out, static_cast<uint32_t>(payload.size()));
+  out.insert(out.end(), payload.begin(), payload.end());
+}
+
+// Appends random instructions of a block nested @depth levels deep.
+void randomInstructions(vector<uint8_t>& out, unsigned depth, uint32_t functions)
+{
+  unsigned count = rng() % 6;
+  for (unsigned i = 0; i < count; ++i) {
+    switch (rng() % 8) {
+    case 0:
+      out.push_back(0x01); // nop
+      break;
+    case 1:
+      out.push_back(0x10); // call
+      writeU32(out, static_cast<uint32_t>(rng() % functions));
+      break;
+    case 2:
+      out.push_back(0x41); // i32.const
+      out.push_back(static_cast<uint8_t>(rng() % 64));
+      out.push_back(0x1a); // drop
+      break;
+    case 3:
+      out.push_back(0x23); // get_global
+      out.push_back(0);
+      out.push_back(0x1a); // drop
+      break;
+    case 4:
+      out.push_back(0x0c); // br
+      writeU32(out, static_cast<uint32_t>(rng() % (depth + 1)));
+      break;
+    default:
+      if (depth >= maxDepth) {
+        out.push_back(0x01);
+        break;
+      }
+      uint8_t op = static_cast<uint8_t>(0x02 + rng() % 3); // block, loop or if
+      if (op == 0x04) {
+        out.push_back(0x41);
+        out.push_back(static_cast<uint8_t>(rng() % 2));
+      }
+      out.push_back(op);
+      out.push_back(0x40);
+      randomInstructions(out, depth + 1, functions);
+      if (op == 0x04 && rng() % 2) {
+        out.push_back(0x05); // else
+        randomInstructions(out, depth + 1, functions);
+      }
+      out.push_back(0x0b);
+      break;
+    }
+  }
+}
+
+// A contract importing a function and a global, with random function bodies.
+vector<uint8_t> randomModule(bool definesGlobal)
+{
+  uint32_t defined = 1 + rng() % 3;
+  vector<uint8_t> module{ 0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00 };
+
+  // () -> () and () -> i32
+  writeSection(module, 1, { 0x02, 0x60, 0x00, 0x00, 0x60, 0x00, 0x01, 0x7f });
+
+  vector<uint8_t> imports;
+  writeU32(imports, 2);
+  writeName(imports, "ethereum");
+  writeName(imports, "getCallDataSize");
+  imports.push_back(0x00);
+  imports.push_back(0x01);
+  writeName(imports, "env");
+  writeName(imports, "value");
+  imports.push_back(0x03);
+  imports.push_back(0x7f);
+  imports.push_back(0x00);
+  writeSection(module, 2, imports);
+
+  vector<uint8_t> functions;
+  writeU32(functions, defined);
+  for (uint32_t i = 0; i < defined; ++i)
+    functions.push_back(0x00);
+  writeSection(module, 3, functions);
+
+  writeSection(module, 5, { 0x01, 0x00, 0x01 });
+
+  if (definesGlobal)
+    writeSection(module, 6, { 0x01, 0x7f, 0x01, 0x41, 0x00, 0x0b });
+
+  vector<uint8_t> exports;
+  writeU32(exports, 2);
+  writeName(exports, "main");
+  exports.push_back(0x00);
+  exports.push_back(0x01);
+  writeName(exports, "memory");
+  exports.push_back(0x02);
+  exports.push_back(0x00);
+  writeSection(module, 7, exports);
+
+  vector<uint8_t> code;
+  writeU32(code, defined);
+  for (uint32_t i = 0; i < defined; ++i) {
+    vector<uint8_t> body{ 0x00 }; // no locals
+    randomInstructions(body, 0, defined + 1);
+    body.push_back(0x0b);
+    writeU32(code, static_cast<uint32_t>(body.size()));
+    code.insert(code.end(), body.begin(), body.end());
+  }
+  writeSection(module, 10, code);
+  return module;
+}
+
+class Reader {
+public:
+  explicit Reader(vector<uint8_t> const& _data, size_t _pos = 0, size_t _end = size_t(-1)):
+    m_data(_data),
+    m_pos(_pos),
+    m_end(_end == size_t(-1) ? _data.size() : _end)
+  {}
+
+  bool atEnd() const { return m_pos >= m_end; }
+  size_t position() const { return m_pos; }
+
+  uint8_t byte()
+  {
+    heraAssert(m_pos < m_end, "Unexpected end of module.");
+    return m_data[m_pos++];
+  }
+
+  uint64_t leb()
+  {
+    uint64_t ret = 0;
+    for (unsigned shift = 0; ; shift += 7) {
+      uint8_t b = byte();
+      ret |= uint64_t(b & 0x7f) << shift;
+      if (!(b & 0x80))
+        return ret;
+    }
+  }
+
+  void skip(size_t length) { m_pos += length; }
+
+private:
+  vector<uint8_t> const& m_data;
+  size_t m_pos;
+  size_t m_end;
+};
+
+// An instruction of a metered body: a charge, or any other instruction as its bytes.
+struct Item {
+  bool charge;
+  uint64_t cost;
+  vector<uint8_t> bytes;
+
+  bool operator==(Item const& other) const { return charge == other.charge && cost == other.cost && bytes == other.bytes; }
+};
+
+// Splits @body into instructions, of the subset generated by randomModule() and
+// injected by the metering.
+vector<vector<uint8_t>> instructions(vector<uint8_t> const& data, size_t begin, size_t end)
+{
+  Reader reader(data, begin, end);
+  for (uint64_t locals = reader.leb(); locals > 0; --locals) {
+    reader.leb();
+    reader.byte();
+  }
+
+  vector<vector<uint8_t>> ret;
+  while (!reader.atEnd()) {
+    size_t start = reader.position();
+    uint8_t op = reader.byte();
+    switch (op) {
+    case 0x02: case 0x03: case 0x04: // block types
+      reader.byte();
+      break;
+    case 0x0c: case 0x10: case 0x23: case 0x24: case 0x41: case 0x42:
+      reader.leb();
+      break;
+    default:
+      break;
+    }
+    ret.emplace_back(data.begin() + start, data.begin() + reader.position());
+  }
+  return ret;
+}
+
+uint64_t immediate(vector<uint8_t> const& instruction)
+{
+  Reader reader(instruction, 1);
+  return reader.leb();
+}
+
+// Turns the charges in the bodies of @module into items, other instructions are kept.
+// @returns the items of each function body.
+vector<vector<Item>> meteredBodies(vector<uint8_t> const& module, MeteringCharge charge, uint32_t gasFunction, uint32_t counter)
+{
+  vector<vector<Item>> ret;
+  Reader reader(module, 8);
+  while (!reader.atEnd()) {
+    uint8_t id = reader.byte();
+    size_t size = reader.leb();
+    if (id != 10) {
+      reader.skip(size);
+      continue;
+    }
+    for (uint64_t count = reader.leb(); count > 0; --count) {
+      size_t bodySize = reader.leb();
+      vector<vector<uint8_t>> body = instructions(module, reader.position(), reader.position() + bodySize);
+      reader.skip(bodySize);
+
+      auto isGet = [&](vector<uint8_t> const& i) { return i[0] == 0x23 && immediate(i) == counter; };
+      vector<Item> items;
+      for (size_t i = 0; i < body.size(); ++i) {
+        if (charge == MeteringCharge::Call && i + 1 < body.size() && body[i][0] == 0x42 &&
+            body[i + 1][0] == 0x10 && immediate(body[i + 1]) == gasFunction) {
+          items.push_back(Item{ true, immediate(body[i]), {} });
+          i += 1;
+        } else if (charge == MeteringCharge::Counter && isGet(body[i])) {
+          // get_global, i64.const, i64.lt_u, if, i64.const, call useGas, end,
+          // get_global, i64.const, i64.sub, set_global
+          heraAssert(i + 10 < body.size(), "Truncated gas counter charge.");
+          uint64_t cost = immediate(body[i + 1]);
+          bool valid =
+            body[i + 1][0] == 0x42 && body[i + 2] == vector<uint8_t>{ 0x54 } && body[i + 3] == vector<uint8_t>{ 0x04, 0x40 } &&
+            body[i + 4][0] == 0x42 && immediate(body[i + 4]) == cost &&
+            body[i + 5][0] == 0x10 && immediate(body[i + 5]) == gasFunction && body[i + 6] == vector<uint8_t>{ 0x0b } &&
+            isGet(body[i + 7]) && body[i + 8][0] == 0x42 && immediate(body[i + 8]) == cost &&
+            body[i + 9] == vector<uint8_t>{ 0x7d } && body[i + 10][0] == 0x24 && immediate(body[i + 10]) == counter;
+          heraAssert(valid, "Malformed gas counter charge.");
+          items.push_back(Item{ true, cost, {} });
+          i += 10;
+        } else {
+          items.push_back(Item{ false, 0, body[i] });
+        }
+      }
+      ret.push_back(move(items));
+    }
+  }
+  return ret;
+}
+
+}
+
+int main()
+{
+  unsigned failures = 0;
+  for (unsigned i = 0; i < iterations; ++i) {
+    bool definesGlobal = i % 2;
+    vector<uint8_t> module = randomModule(definesGlobal);
+
+    vector<uint8_t> called = injectMetering(module, MeteringCharge::Call);
+    vector<uint8_t> counted = injectMetering(module, MeteringCharge::Counter);
+
+    // useGas is appended to the imported functions, the counter to the globals.
+    uint32_t gasFunction = 1;
+    uint32_t counter = definesGlobal ? 2 : 1;
+    bool same;
+    try {
+      vector<vector<Item>> expected = meteredBodies(called, MeteringCharge::Call, gasFunction, counter);
+      vector<vector<Item>> actual = meteredBodies(counted, MeteringCharge::Counter, gasFunction, counter);
+      bool charged = !expected.empty() && !expected[0].empty() && expected[0][0].charge;
+      same = charged && expected == actual;
+    } catch (InternalErrorException const& e) {
+      cerr << e.what() << "\n";
+      same = false;
+    }
+    if (!same && failures++ < 10)
+      cerr << "Charges differ between the modes in module " << i << "\n";
+  }
+
+  cout << "metering: " << failures << " failures in " << iterations << " modules\n";
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compares every implementation of the byte primitives supported by the CPU
+// with straightforward scalar versions on random inputs.
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "primitives.h"
+
+using namespace std;
+using namespace hera;
+
+namespace {
+
+constexpr unsigned iterations = 100000;
+// Room for unaligned accesses at any offset.
+constexpr size_t bufferSize = 64;
+
+mt19937_64 rng(0x68657261);
+
+void fillRandom(vector<uint8_t> & buffer)
+{
+  for (auto& b: buffer)
+    b = static_cast<uint8_t>(rng());
+}
+
+// Mostly zero inputs, so that the zero test sees both outcomes.
+void fillSparse(vector<uint8_t> & buffer)
+{
+  fill(buffer.begin(), buffer.end(), 0);
+  if (rng() % 2)
+    buffer[rng() % buffer.size()] = static_cast<uint8_t>(rng() | 1);
+}
+
+unsigned checkReverse(char const* name)
+{
+  unsigned failures = 0;
+  vector<uint8_t> src(bufferSize);
+  for (unsigned i = 0; i < iterations; ++i) {
+    fillRandom(src);
+    size_t length = (i % 3 == 0) ? 16 : (i % 3 == 1) ? 32 : rng() % 33;
+    size_t offset = rng() % (bufferSize - length + 1);
+
+    vector<uint8_t> expected(bufferSize, 0xaa);
+    vector<uint8_t> actual(bufferSize, 0xaa);
+    reverse_copy(src.begin() + offset, src.begin() + offset + length, expected.begin() + offset);
+    reverseBytes(src.data() + offset, actual.data() + offset, length);
+    if (expected != actual && failures++ < 10)
+      cerr << name << ": reverseBytes mismatch, length " << length << " at offset " << offset << "\n";
+  }
+  return failures;
+}
+
+unsigned checkIsZero()
+{
+  unsigned failures = 0;
+  vector<uint8_t> data(bufferSize);
+  for (unsigned i = 0; i < iterations; ++i) {
+    size_t length = (i % 3 == 0) ? 16 : (i % 3 == 1) ? 32 : rng() % 33;
+    size_t offset = rng() % (bufferSize - length + 1);
+    fillSparse(data);
+
+    bool expected = all_of(data.begin() + offset, data.begin() + offset + length, [](uint8_t b) { return b == 0; });
+    if (isZeroBytes(data.data() + offset, length) != expected && failures++ < 10)
+      cerr << "isZeroBytes mismatch, length " << length << " at offset " << offset << "\n";
+  }
+  return failures;
+}
+
+}
+
+int main()
+{
+  struct {
+    PrimitivesImplementation implementation;
+    char const* name;
+  } const implementations[] = {
+    { PrimitivesImplementation::Scalar, "scalar" },
+    { PrimitivesImplementation::Ssse3, "ssse3" },
+    { PrimitivesImplementation::Avx2, "avx2" },
+  };
+
+  unsigned failures = 0;
+  for (auto const& candidate: implementations) {
+    if (!selectPrimitives(candidate.implementation)) {
+      cout << candidate.name << ": not supported by the CPU, skipped\n";
+      continue;
+    }
+    unsigned implementationFailures = checkReverse(candidate.name);
+    cout << candidate.name << ": " << implementationFailures << " failures\n";
+    failures += implementationFailures;
+  }
+
+  unsigned zeroFailures = checkIsZero();
+  cout << "isZeroBytes: " << zeroFailures << " failures\n";
+  failures += zeroFailures;
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2016-2018 Alex Beregszaszi et al.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Converts a binary state access trace (see trace-format.h) back to the text format.
+//
+// Usage:
+//   hera-trace-decode <trace>            decode every transaction
+//   hera-trace-decode <trace> --tx <n>   decode only the transaction with sequence number n (using <trace>.idx)
+//   hera-trace-decode <trace> --count    print the number of transactions in the index
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "trace-format.h"
+
+using namespace std;
+using namespace hera;
+
+namespace {
+
+bool readExactly(FILE* file, void* data, size_t length)
+{
+  return fread(data, 1, length, file) == length;
+}
+
+uint64_t readLE64(uint8_t const* bytes)
+{
+  uint64_t ret = 0;
+  for (unsigned i = 0; i < 8; ++i)
+    ret |= uint64_t(bytes[i]) << (8 * i);
+  return ret;
+}
+
+bool checkMagic(FILE* file, char const (&magic)[8])
+{
+  char header[8];
+  return readExactly(file, header, sizeof(header)) && memcmp(header, magic, sizeof(header)) == 0;
+}
+
+bool decodeBlock(vector<uint8_t> const& payload)
+{
+  TraceBlockDecoder decoder(payload.data(), payload.size());
+  uint64_t sequence;
+  evmc_address recipient;
+  if (!decoder.begin(sequence, recipient))
+    return false;
+
+  TraceRecord record;
+  char line[traceMaxLineLength];
+  while (decoder.next(record))
+    fwrite(line, 1, formatTraceRecord(record, line), stdout);
+  return !decoder.malformed();
+}
+
+// Reads the varint length prefix of a block directly from the file.
+bool readBlockLength(FILE* file, uint64_t & length)
+{
+  length = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    int c = fgetc(file);
+    if (c == EOF)
+      return false;
+    length |= uint64_t(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return true;
+  }
+  return false;
+}
+
+int decodeAll(FILE* data)
+{
+  uint64_t length;
+  while (readBlockLength(data, length)) {
+    vector<uint8_t> payload(length);
+    if (!readExactly(data, payload.data(), payload.size()) || !decodeBlock(payload)) {
+      cerr << "Malformed block in trace\n";
+      return 1;
+    }
+  }
+  return feof(data) ? 0 : 1;
+}
+
+// @returns the number of entries in the index, or -1 if it is invalid.
+long indexEntries(FILE* index)
+{
+  if (!checkMagic(index, traceIndexMagic))
+    return -1;
+  fseek(index, 0, SEEK_END);
+  long size = ftell(index) - static_cast<long>(sizeof(traceIndexMagic));
+  return size / static_cast<long>(traceIndexEntrySize);
+}
+
+int decodeTransaction(FILE* data, FILE* index, uint64_t sequence)
+{
+  if (indexEntries(index) < 0) {
+    cerr << "Invalid index\n";
+    return 1;
+  }
+
+  // The entry of a transaction is at a fixed offset.
+  uint8_t entry[traceIndexEntrySize];
+  long position = static_cast<long>(sizeof(traceIndexMagic) + sequence * traceIndexEntrySize);
+  if (fseek(index, position, SEEK_SET) != 0 || !readExactly(index, entry, sizeof(entry)) || readLE64(entry) != sequence) {
+    cerr << "No transaction " << sequence << " in the index\n";
+    return 1;
+  }
+  uint64_t offset = readLE64(entry + 8);
+  uint64_t length = readLE64(entry + 16);
+  // The transaction had no records.
+  if (length == 0)
+    return 0;
+
+  vector<uint8_t> payload(length);
+  if (fseek(data, static_cast<long>(offset), SEEK_SET) != 0 || !readExactly(data, payload.data(), payload.size()) || !decodeBlock(payload)) {
+    cerr << "Malformed block in trace\n";
+    return 1;
+  }
+  return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 2 && !(argc == 3 && strcmp(argv[2], "--count") == 0) && !(argc == 4 && strcmp(argv[2], "--tx") == 0)) {
+    cerr << "Usage: " << argv[0] << " <trace> [--tx <n> | --count]\n";
+    return 2;
+  }
+
+  string path(argv[1]);
+
+  if (argc == 3) {
+    FILE* index = fopen((path + ".idx").c_str(), "rb");
+    long entries = index ? indexEntries(index) : -1;
+    if (entries < 0) {
+      cerr << "Failed to open index: " << path << ".idx\n";
+      return 1;
+    }
+    cout << entries << "\n";
+    fclose(index);
+    return 0;
+  }
+
+  FILE* data = fopen(path.c_str(), "rb");
+  if (!data || !checkMagic(data, traceDataMagic)) {
+    cerr << "Not a binary trace: " << path << "\n";
+    return 1;
+  }
+
+  int ret;
+  if (argc == 2) {
+    ret = decodeAll(data);
+  } else {
+    FILE* index = fopen((path + ".idx").c_str(), "rb");
+    if (!index) {
+      cerr << "Failed to open index: " << path << ".idx\n";
+      return 1;
+    }
+    ret = decodeTransaction(data, index, strtoull(argv[3], nullptr, 10));
+    fclose(index);
+  }
+  fclose(data);
+  return ret;
+}